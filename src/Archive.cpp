@@ -0,0 +1,272 @@
+#include "Archive.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_set>
+#include <utility>
+
+#include "Hash.h"
+
+namespace {
+	constexpr char ARCHIVE_MAGIC[4] = {'H', 'L', 'P', 'K'};
+	constexpr auto ALIGNMENT = 16; // entry data is aligned relative to the file start, which is page aligned when mapped
+
+	void pad(std::ostream& os) {
+		while (os.tellp() % ALIGNMENT != 0)
+			os.put(0);
+	}
+
+	auto hashName(std::string_view name) {
+		return fnv1a64({reinterpret_cast<const std::uint8_t*>(name.data()), name.size()});
+	}
+
+	// PackBits style run-length encoding: a control byte c < 128 is followed by c + 1 literal bytes,
+	// a control byte c >= 128 is followed by one byte repeated c - 125 times (3 to 130 times).
+	auto rleEncode(std::span<const std::uint8_t> in) -> std::vector<std::uint8_t> {
+		std::vector<std::uint8_t> out;
+		out.reserve(in.size());
+		std::size_t i = 0;
+		while (i < in.size()) {
+			std::size_t run = 1;
+			while (i + run < in.size() && run < 130 && in[i + run] == in[i])
+				run++;
+			if (run >= 3) {
+				out.push_back(static_cast<std::uint8_t>(run + 125));
+				out.push_back(in[i]);
+				i += run;
+				continue;
+			}
+
+			auto j = i;
+			while (j < in.size() && j - i < 128) {
+				if (j + 2 < in.size() && in[j] == in[j + 1] && in[j] == in[j + 2])
+					break;
+				j++;
+			}
+			out.push_back(static_cast<std::uint8_t>(j - i - 1));
+			out.insert(out.end(), in.begin() + i, in.begin() + j);
+			i = j;
+		}
+		return out;
+	}
+
+	auto rleDecode(std::span<const std::uint8_t> in, std::size_t size) -> std::vector<std::uint8_t> {
+		std::vector<std::uint8_t> out;
+		out.reserve(size);
+		std::size_t i = 0;
+		while (i < in.size()) {
+			const auto c = in[i++];
+			if (c < 128) {
+				const auto count = std::size_t{c} + 1;
+				if (count > in.size() - i)
+					throw std::runtime_error("Corrupt RLE data");
+				out.insert(out.end(), in.begin() + i, in.begin() + i + count);
+				i += count;
+			} else {
+				if (i == in.size())
+					throw std::runtime_error("Corrupt RLE data");
+				out.insert(out.end(), std::size_t{c} - 125, in[i++]);
+			}
+		}
+		if (out.size() != size)
+			throw std::runtime_error("Corrupt RLE data");
+		return out;
+	}
+
+	auto mounts() -> std::vector<std::pair<fs::path, Archive>>& {
+		static std::vector<std::pair<fs::path, Archive>> mounts;
+		return mounts;
+	}
+
+	// Returns the name of the entry a path refers to in an archive mounted at root, empty if the path is not below root
+	auto entryName(const fs::path& path, const fs::path& root) -> std::string {
+		const auto rel = path.lexically_normal().lexically_relative(root.lexically_normal());
+		if (rel.empty() || *rel.begin() == "..")
+			return {};
+		return rel.generic_string();
+	}
+}
+
+Archive::Archive(const fs::path& path)
+	: m_file(path), m_modified(fs::last_write_time(path).time_since_epoch().count()) {
+	const auto header = m_file.read<Header>(0);
+	if (!std::equal(std::begin(ARCHIVE_MAGIC), std::end(ARCHIVE_MAGIC), header.magic))
+		throw std::ios::failure("Invalid archive magic number in " + path.string());
+	if (header.version != version)
+		throw std::ios::failure("Unsupported archive version " + std::to_string(header.version) + " of " + path.string());
+	if (header.bucketCount == 0 || (header.bucketCount & (header.bucketCount - 1)) != 0)
+		throw std::ios::failure("Corrupt archive index in " + path.string());
+
+	m_entries = m_file.view<Entry>(header.indexOffset, header.entryCount);
+	const auto bucketsOffset = header.indexOffset + m_entries.size_bytes();
+	m_buckets = m_file.view<std::uint32_t>(bucketsOffset, header.bucketCount);
+	const auto namesOffset = bucketsOffset + m_buckets.size_bytes();
+	m_names = m_file.view<char>(namesOffset, m_file.size() - namesOffset);
+
+	// chains link each entry to an earlier one, so lookups always end
+	for (auto i = 0u; i < m_entries.size(); i++)
+		if (m_entries[i].next != noEntry && m_entries[i].next >= i)
+			throw std::ios::failure("Corrupt archive index in " + path.string());
+	for (const auto head : m_buckets)
+		if (head != noEntry && head >= m_entries.size())
+			throw std::ios::failure("Corrupt archive index in " + path.string());
+
+	std::clog << "Opened archive " << path << " with " << m_entries.size() << " entries\n";
+}
+
+auto Archive::normalizeName(std::string_view name) -> std::string {
+	std::string result(name);
+	for (auto& c : result)
+		c = c == '\\' ? '/' : static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	return result;
+}
+
+auto Archive::find(std::string_view name) const -> std::optional<MappedFile> {
+	if (const auto e = lookup(name))
+		return open(*e);
+	return {};
+}
+
+auto Archive::entrySize(std::string_view name) const -> std::optional<std::uint64_t> {
+	if (const auto e = lookup(name))
+		return e->size;
+	return {};
+}
+
+auto Archive::lookup(std::string_view name) const -> const Entry* {
+	const auto normalized = normalizeName(name);
+	const auto hash = hashName(normalized);
+	for (auto i = m_buckets[hash & (m_buckets.size() - 1)]; i != noEntry; i = m_entries[i].next) {
+		if (i >= m_entries.size())
+			throw std::runtime_error("Corrupt archive index");
+		const auto& e = m_entries[i];
+		if (e.nameHash == hash && e.nameOffset + std::size_t{e.nameLength} <= m_names.size() && std::string_view{m_names.data() + e.nameOffset, e.nameLength} == normalized)
+			return &e;
+	}
+	return nullptr;
+}
+
+auto Archive::open(const Entry& e) const -> MappedFile {
+	const auto stored = m_file.section(e.offset, e.storedSize);
+	switch (e.codec) {
+		case Codec::Stored:
+			return stored;
+		case Codec::Rle: {
+			auto data = std::make_shared<const std::vector<std::uint8_t>>(rleDecode(stored.bytes(), e.size));
+			const auto bytes = std::span<const std::uint8_t>{*data};
+			return {std::move(data), bytes};
+		}
+	}
+	throw std::runtime_error("Unknown archive codec " + std::to_string(static_cast<std::uint32_t>(e.codec)));
+}
+
+void Archive::pack(const fs::path& path, std::span<const Source> sources, bool compress) {
+	std::ofstream os(path, std::ios::binary);
+	if (!os)
+		throw std::ios::failure("Failed to open file " + path.string() + " for writing");
+	os.exceptions(std::ios::badbit | std::ios::failbit);
+
+	write(os, Header{}); // patched at the end
+
+	std::vector<Entry> entries;
+	std::string names;
+	std::unordered_set<std::string> packed;
+	for (const auto& source : sources) {
+		auto name = normalizeName(source.name);
+		if (!packed.insert(name).second)
+			continue;
+
+		const auto file = openFile(source.path);
+		Entry e{};
+		e.nameHash = hashName(name);
+		e.size = file.size();
+		e.nameOffset = static_cast<std::uint32_t>(names.size());
+		e.nameLength = static_cast<std::uint32_t>(name.size());
+		names += name;
+
+		pad(os);
+		e.offset = static_cast<std::uint64_t>(os.tellp());
+		std::vector<std::uint8_t> compressed;
+		if (compress) {
+			compressed = rleEncode(file.bytes());
+			if (compressed.size() > file.size() - file.size() / 8)
+				compressed.clear();
+		}
+		if (!compressed.empty()) {
+			e.codec = Codec::Rle;
+			e.storedSize = compressed.size();
+			writeVector(os, std::span<const std::uint8_t>{compressed});
+		} else {
+			e.codec = Codec::Stored;
+			e.storedSize = file.size();
+			writeVector(os, file.bytes());
+		}
+		entries.push_back(e);
+
+		std::clog << "Packed " << name << " (" << e.size << " -> " << e.storedSize << " bytes)\n";
+	}
+
+	std::uint32_t bucketCount = 1;
+	while (bucketCount < entries.size())
+		bucketCount *= 2;
+	std::vector<std::uint32_t> buckets(bucketCount, noEntry);
+	for (auto i = 0u; i < entries.size(); i++) {
+		auto& head = buckets[entries[i].nameHash & (bucketCount - 1)];
+		entries[i].next = head;
+		head = i;
+	}
+
+	pad(os);
+	Header header{};
+	std::copy(std::begin(ARCHIVE_MAGIC), std::end(ARCHIVE_MAGIC), header.magic);
+	header.version = version;
+	header.entryCount = static_cast<std::uint32_t>(entries.size());
+	header.bucketCount = bucketCount;
+	header.indexOffset = static_cast<std::uint64_t>(os.tellp());
+	writeVector(os, std::span<const Entry>{entries});
+	writeVector(os, std::span<const std::uint32_t>{buckets});
+	os.write(names.data(), names.size());
+
+	os.seekp(0);
+	write(os, header);
+
+	std::clog << "Wrote archive " << path << " with " << entries.size() << " entries\n";
+}
+
+void mountArchive(const fs::path& path, const fs::path& root) {
+	mounts().emplace_back(root, Archive(path));
+}
+
+auto openFile(const fs::path& path) -> MappedFile {
+	const auto& ms = mounts();
+	for (auto it = ms.rbegin(); it != ms.rend(); ++it)
+		if (const auto name = entryName(path, it->first); !name.empty())
+			if (auto file = it->second.find(name))
+				return std::move(*file);
+	return MappedFile(path);
+}
+
+auto fileExists(const fs::path& path) -> bool {
+	const auto& ms = mounts();
+	for (auto it = ms.rbegin(); it != ms.rend(); ++it)
+		if (const auto name = entryName(path, it->first); !name.empty())
+			if (it->second.contains(name))
+				return true;
+	return fs::exists(path);
+}
+
+auto fileStamp(const fs::path& path) -> std::optional<FileStamp> {
+	const auto& ms = mounts();
+	for (auto it = ms.rbegin(); it != ms.rend(); ++it)
+		if (const auto name = entryName(path, it->first); !name.empty())
+			if (const auto size = it->second.entrySize(name))
+				return FileStamp{*size, it->second.modified()};
+	std::error_code ec;
+	const auto size = fs::file_size(path, ec);
+	const auto modified = fs::last_write_time(path, ec);
+	if (ec)
+		return {};
+	return FileStamp{size, modified.time_since_epoch().count()};
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "IO.h"
+
+inline const auto DATA_DIR = fs::path("../data"); // root of all game data, archives mounted without a root stand in for it
+
+/// @brief Read-only pak-style archive of game data files (.hlpak)
+/// All entries live in one mapped file and are found through a hashed index of their normalized names (relative path, lower case, forward slashes).
+/// Stored entries are aligned and handed out as views into the mapping without copying. Entries may also be run-length compressed,
+/// those are decompressed into memory on every open.
+class Archive {
+public:
+	static constexpr std::uint32_t version = 1;
+
+	enum class Codec : std::uint32_t {
+		Stored,
+		Rle
+	};
+
+	struct Source {
+		std::string name; // name of the entry, normalized when packing
+		fs::path path;    // file to read the content from
+	};
+
+	explicit Archive(const fs::path& path);
+
+	auto find(std::string_view name) const -> std::optional<MappedFile>; // nullopt if the archive has no such entry
+	auto contains(std::string_view name) const -> bool { return lookup(name) != nullptr; }
+	auto entrySize(std::string_view name) const -> std::optional<std::uint64_t>; // uncompressed size, nullopt if the archive has no such entry
+	auto modified() const -> std::int64_t { return m_modified; } // last write time of the archive file
+	auto entryCount() const -> std::size_t { return m_entries.size(); }
+
+	// Writes an archive containing all sources. Entries are compressed if compress is set and it saves at least an eighth of their size.
+	static void pack(const fs::path& path, std::span<const Source> sources, bool compress);
+
+	static auto normalizeName(std::string_view name) -> std::string;
+
+private:
+	struct Header {
+		char magic[4];
+		std::uint32_t version;
+		std::uint32_t entryCount;
+		std::uint32_t bucketCount; // power of two
+		std::uint64_t indexOffset; // entries, followed by the buckets, followed by the names
+	};
+
+	struct Entry {
+		std::uint64_t nameHash;
+		std::uint64_t offset;
+		std::uint64_t storedSize;
+		std::uint64_t size;
+		std::uint32_t nameOffset;
+		std::uint32_t nameLength;
+		Codec codec;
+		std::uint32_t next; // earlier entry in the same bucket, noEntry at the end of the chain
+	};
+
+	static constexpr auto noEntry = ~std::uint32_t{0};
+
+	auto lookup(std::string_view name) const -> const Entry*;
+	auto open(const Entry& e) const -> MappedFile;
+
+	MappedFile m_file;
+	std::int64_t m_modified;
+	std::span<const Entry> m_entries;
+	std::span<const std::uint32_t> m_buckets;
+	std::span<const char> m_names;
+};
+
+// Makes the files of an archive visible below root. Mount all archives before loading anything, later mounts take precedence.
+void mountArchive(const fs::path& path, const fs::path& root = DATA_DIR);
+
+// Opens a file from the mounted archives, or from the file system if no archive contains it
+auto openFile(const fs::path& path) -> MappedFile;
+auto fileExists(const fs::path& path) -> bool;
+
+// Cheap identity of a file's content, changes whenever the file is rewritten
+struct FileStamp {
+	std::uint64_t size;
+	std::int64_t modified; // last write time, of the archive for files from an archive
+
+	auto operator==(const FileStamp&) const -> bool = default;
+};
+auto fileStamp(const fs::path& path) -> std::optional<FileStamp>; // nullopt if the file does not exist
@@ -0,0 +1,274 @@
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "Archive.h"
+#include "Hash.h"
+#include "IO.h"
+#include "ThreadPool.h"
+
+namespace {
+	constexpr char CACHE_MAGIC[4] = {'H', 'L', 'T', 'C'};
+	constexpr std::uint32_t CACHE_VERSION = 1;
+	const auto TEXTURE_CACHE_DIR = DATA_DIR / "texcache";
+
+	using Block = std::array<std::array<std::uint8_t, 4>, 16>; // RGBA texels of a 4x4 block in row order
+
+	auto to565(int r, int g, int b) -> std::uint16_t {
+		return static_cast<std::uint16_t>(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+	}
+
+	auto from565(std::uint16_t c) -> std::array<int, 3> {
+		const auto r = (c >> 11) & 31;
+		const auto g = (c >> 5) & 63;
+		const auto b = c & 31;
+		return {(r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2)};
+	}
+
+	// Bounding box endpoints along the dominant diagonal, inset to reduce the error of the outer texels
+	void encodeColor(const Block& block, std::uint8_t* out) {
+		int lo[3] = {255, 255, 255};
+		int hi[3] = {0, 0, 0};
+		for (const auto& t : block)
+			for (auto c = 0; c < 3; c++) {
+				lo[c] = std::min<int>(lo[c], t[c]);
+				hi[c] = std::max<int>(hi[c], t[c]);
+			}
+
+		// the box diagonal matching the sign of the covariance of red and blue with green
+		int center[3];
+		for (auto c = 0; c < 3; c++)
+			center[c] = (lo[c] + hi[c]) / 2;
+		int covRG = 0;
+		int covBG = 0;
+		for (const auto& t : block) {
+			covRG += (t[0] - center[0]) * (t[1] - center[1]);
+			covBG += (t[2] - center[2]) * (t[1] - center[1]);
+		}
+		if (covRG < 0)
+			std::swap(lo[0], hi[0]);
+		if (covBG < 0)
+			std::swap(lo[2], hi[2]);
+
+		for (auto c = 0; c < 3; c++) {
+			const auto inset = (hi[c] - lo[c]) / 16;
+			hi[c] -= inset;
+			lo[c] += inset;
+		}
+
+		auto c0 = to565(hi[0], hi[1], hi[2]);
+		auto c1 = to565(lo[0], lo[1], lo[2]);
+		if (c0 < c1)
+			std::swap(c0, c1); // c0 > c1 selects the four color mode
+
+		std::uint32_t indices = 0;
+		if (c0 != c1) {
+			const auto p0 = from565(c0);
+			const auto p1 = from565(c1);
+			std::array<std::array<int, 3>, 4> palette;
+			for (auto c = 0; c < 3; c++) {
+				palette[0][c] = p0[c];
+				palette[1][c] = p1[c];
+				palette[2][c] = (2 * p0[c] + p1[c]) / 3;
+				palette[3][c] = (p0[c] + 2 * p1[c]) / 3;
+			}
+			for (auto i = 0; i < 16; i++) {
+				auto best = 0u;
+				auto bestError = INT_MAX;
+				for (auto p = 0u; p < 4; p++) {
+					auto error = 0;
+					for (auto c = 0; c < 3; c++) {
+						const auto d = block[i][c] - palette[p][c];
+						error += d * d;
+					}
+					if (error < bestError) {
+						bestError = error;
+						best = p;
+					}
+				}
+				indices |= best << (2 * i);
+			}
+		}
+
+		std::memcpy(out + 0, &c0, 2);
+		std::memcpy(out + 2, &c1, 2);
+		std::memcpy(out + 4, &indices, 4);
+	}
+
+	void encodeAlpha(const Block& block, std::uint8_t* out) {
+		int a0 = 0;
+		int a1 = 255;
+		for (const auto& t : block) {
+			a0 = std::max<int>(a0, t[3]);
+			a1 = std::min<int>(a1, t[3]);
+		}
+
+		// a0 > a1 selects eight interpolated values
+		std::uint64_t indices = 0;
+		if (a0 != a1) {
+			std::array<int, 8> values = {a0, a1};
+			for (auto i = 1; i < 7; i++)
+				values[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+			for (auto i = 0; i < 16; i++) {
+				auto best = 0ull;
+				auto bestError = 256;
+				for (auto v = 0ull; v < 8; v++)
+					if (const auto error = std::abs(block[i][3] - values[v]); error < bestError) {
+						bestError = error;
+						best = v;
+					}
+				indices |= best << (3 * i);
+			}
+		}
+
+		out[0] = static_cast<std::uint8_t>(a0);
+		out[1] = static_cast<std::uint8_t>(a1);
+		for (auto i = 0; i < 6; i++)
+			out[2 + i] = static_cast<std::uint8_t>(indices >> (8 * i));
+	}
+
+	auto cachePath(std::uint64_t hash) {
+		std::ostringstream name;
+		name << std::hex << std::setw(16) << std::setfill('0') << hash << ".bct";
+		return TEXTURE_CACHE_DIR / name.str();
+	}
+
+	auto blockBytesOf(BlockFormat format, unsigned int width, unsigned int height) -> std::size_t {
+		return std::size_t{(width + 3) / 4} * ((height + 3) / 4) * blockBytes(format);
+	}
+
+	// Returns the cached levels if they match the sizes of the expected levels and the forced format, otherwise nothing
+	auto readCache(const fs::path& path, std::span<const ImageView> expected, std::optional<BlockFormat> format) -> std::vector<CompressedImage> {
+		std::ifstream is(path, std::ios::binary);
+		if (!is)
+			return {};
+		is.exceptions(std::ios::badbit | std::ios::failbit | std::ios::eofbit);
+		try {
+			char magic[4];
+			read(is, magic);
+			if (std::memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 || read<std::uint32_t>(is) != CACHE_VERSION)
+				return {};
+			if (read<std::uint32_t>(is) != expected.size())
+				throw std::ios::failure("level count mismatch");
+			std::vector<CompressedImage> levels(expected.size());
+			for (auto i = 0u; i < levels.size(); i++) {
+				auto& l = levels[i];
+				read(is, l.format);
+				read(is, l.width);
+				read(is, l.height);
+				if (l.format != BlockFormat::BC1 && l.format != BlockFormat::BC3)
+					throw std::ios::failure("unknown block format");
+				if (l.format != (format ? *format : levels.front().format) || l.width != expected[i].width || l.height != expected[i].height)
+					throw std::ios::failure("level mismatch");
+				const auto size = read<std::uint32_t>(is);
+				if (size != blockBytesOf(l.format, l.width, l.height))
+					throw std::ios::failure("block size mismatch");
+				l.blocks = readVector<std::uint8_t>(is, size);
+			}
+			return levels;
+		} catch (const std::ios::failure& e) {
+			std::clog << "Ignoring corrupt texture cache file " << path << ": " << e.what() << "\n";
+			return {};
+		}
+	}
+
+	void writeCache(const fs::path& path, std::span<const CompressedImage> levels) {
+		// written under a temporary name, so concurrent processes never read a partial file
+		std::error_code ec;
+		fs::create_directories(path.parent_path(), ec);
+		auto tmp = path;
+		tmp += ".tmp";
+		{
+			std::ofstream os(tmp, std::ios::binary);
+			if (!os) {
+				std::clog << "Failed to write texture cache file " << tmp << "\n";
+				return;
+			}
+			write(os, CACHE_MAGIC);
+			write(os, CACHE_VERSION);
+			write(os, static_cast<std::uint32_t>(levels.size()));
+			for (const auto& l : levels) {
+				write(os, l.format);
+				write(os, l.width);
+				write(os, l.height);
+				write(os, static_cast<std::uint32_t>(l.blocks.size()));
+				writeVector(os, std::span{l.blocks});
+			}
+		}
+		fs::rename(tmp, path, ec);
+	}
+}
+
+auto blockBytes(BlockFormat format) -> unsigned int {
+	return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+auto compressImage(ImageView rgba, BlockFormat format, ThreadPool& pool) -> CompressedImage {
+	if (rgba.channels != 4)
+		throw std::logic_error("Block compression requires RGBA images");
+
+	CompressedImage result{format, rgba.width, rgba.height, {}};
+	const auto blocksX = (rgba.width + 3) / 4;
+	const auto blocksY = (rgba.height + 3) / 4;
+	const auto bytes = blockBytes(format);
+	result.blocks.resize(blockBytesOf(format, rgba.width, rgba.height));
+
+	pool.parallelFor(blocksY, [&](std::size_t by) {
+		for (auto bx = 0u; bx < blocksX; bx++) {
+			// texels outside the image repeat the last row and column
+			Block block;
+			for (auto y = 0u; y < 4; y++)
+				for (auto x = 0u; x < 4; x++) {
+					const auto* t = rgba(std::min(bx * 4 + x, rgba.width - 1), std::min(static_cast<unsigned int>(by) * 4 + y, rgba.height - 1));
+					std::copy(t, t + 4, block[y * 4 + x].begin());
+				}
+
+			auto* out = &result.blocks[(by * blocksX + bx) * bytes];
+			if (format == BlockFormat::BC3) {
+				encodeAlpha(block, out);
+				out += 8;
+			}
+			encodeColor(block, out);
+		}
+	});
+	return result;
+}
+
+auto compressMipmaps(std::span<const ImageView> levels, std::uint64_t hash, std::optional<BlockFormat> format) -> std::vector<CompressedImage> {
+	if (format) {
+		const auto f = static_cast<std::uint8_t>(static_cast<std::uint8_t>(*format) + 1);
+		hash = fnv1a64({&f, 1}, hash); // forced formats are cached separately
+	}
+	const auto path = cachePath(hash);
+	if (auto cached = readCache(path, levels, format); !cached.empty())
+		return cached;
+
+	if (!format) {
+		const auto opaque = std::all_of(begin(levels), end(levels), [](const ImageView& img) {
+			for (auto y = 0u; y < img.height; y++) {
+				const auto row = img.row(y);
+				for (auto i = 3u; i < row.size(); i += 4)
+					if (row[i] != 255)
+						return false;
+			}
+			return true;
+		});
+		format = opaque ? BlockFormat::BC1 : BlockFormat::BC3;
+	}
+
+	std::vector<CompressedImage> compressed;
+	compressed.reserve(levels.size());
+	for (const auto& level : levels)
+		compressed.push_back(compressImage(level, *format, ThreadPool::shared()));
+
+	writeCache(path, compressed);
+	return compressed;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "Image.h"
+
+class ThreadPool;
+
+enum class BlockFormat : std::uint32_t {
+	BC1, // opaque RGB, 8 bytes per 4x4 block
+	BC3, // RGB with interpolated alpha, 16 bytes per 4x4 block
+};
+
+struct CompressedImage {
+	BlockFormat format;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::vector<std::uint8_t> blocks; // rows of 4x4 blocks, partial blocks at the right and bottom edge are padded
+};
+
+auto blockBytes(BlockFormat format) -> unsigned int;
+
+// Encodes an RGBA image, the blocks are distributed over the pool
+auto compressImage(ImageView rgba, BlockFormat format, ThreadPool& pool) -> CompressedImage;
+
+// Encodes all mip levels in the given format, or as BC3 if any texel is not opaque and as BC1 otherwise.
+// Results are kept in an on-disk cache keyed by hash, which must identify the content of the levels.
+auto compressMipmaps(std::span<const ImageView> levels, std::uint64_t hash, std::optional<BlockFormat> format = {}) -> std::vector<CompressedImage>;
@@ -1,17 +1,30 @@
 #include "Bsp.h"
 
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <vector>
 
+#include "Archive.h"
+#include "BspCache.h"
 #include "IO.h"
+#include "TaskGraph.h"
+#include "TextureStore.h"
+#include "ThreadPool.h"
+#include "global.h"
 
 namespace {
-	const auto WAD_DIR = fs::path("../data/wads");
-	const auto SKY_DIR = fs::path("../data/textures/sky");
+	const auto WAD_DIR = DATA_DIR / "wads";
+	const auto SKY_DIR = DATA_DIR / "textures/sky";
+	const fs::path DECAL_WADS[] = {WAD_DIR / "valve/decals.wad", WAD_DIR / "cstrike/decals.wad"};
+
+	auto worldTextureKind() {
+		return global::palettizedTextures ? TextureKind::Palettized : TextureKind::World;
+	}
 }
 
 void Bsp::LoadWadFiles(std::string wadStr) {
@@ -37,52 +50,79 @@ void Bsp::LoadWadFiles(std::string wadStr) {
 		}
 
 		wadFiles.emplace_back(WAD_DIR / path);
+		wadPaths.push_back(WAD_DIR / path);
 		std::clog << "#" << std::setw(2) << nWadCount++ << " Loaded " << path << "\n";
 		pos = next;
 	}
 
 	std::clog << "Loaded " << nWadCount << " WADs ";
 	std::clog << "OK\n";
+
+	IndexWadFiles();
+}
+
+void Bsp::IndexWadFiles() {
+	std::size_t entries = 0;
+	for (const auto& wad : wadFiles)
+		entries += wad.directory().size();
+	wadTextureIndex.reserve(entries);
+
+	// a name already present came from a WAD listed earlier, which wins
+	for (auto w = 0u; w < wadFiles.size(); w++)
+		for (const auto& [name, entry] : wadFiles[w].directory())
+			wadTextureIndex.emplace(name, WadTextureRef{w, entry});
+
+	// report WADs which do not provide any texture of this map
+	std::vector<bool> used(wadFiles.size());
+	for (const auto& mipTex : mipTextures) {
+		if (mipTex.offsets[0] != 0)
+			continue;
+		const auto it = wadTextureIndex.find(std::string_view{mipTex.name, strnlen(mipTex.name, bsp30::MAXTEXTURENAME)});
+		if (it != end(wadTextureIndex))
+			used[it->second.wad] = true;
+	}
+	for (auto w = 0u; w < wadFiles.size(); w++)
+		if (!used[w])
+			std::clog << "WAD " << wadPaths[w].filename() << " is not used by this map\n";
 }
 
 void Bsp::UnloadWadFiles() {
+	wadTextureIndex.clear();
 	wadFiles.clear();
 }
 
-void Bsp::LoadTextures(std::ifstream& file) {
-	std::clog << "Loading WADs ...\n";
-	if (const auto worldSpawn = FindEntity("worldspawn"))
-		if (const auto wad = worldSpawn->findProperty("wad"))
-			LoadWadFiles(*wad);
-
+void Bsp::LoadTextures(ThreadPool& pool) {
 	std::clog << "Loading textures ...\n";
 
-	// generate textures from OpenGL
-	m_textures.reserve(textureHeader.mipTextureCount);
+	std::atomic<std::size_t> errors = 0;
+	pool.parallelFor(textureHeader.mipTextureCount, [&](std::size_t i) {
+		if (m_cancelTextureLoad)
+			return;
 
-	std::size_t errors = 0;
-	for (unsigned int i = 0; i < textureHeader.mipTextureCount; i++) {
-		MipmapTexture& mipTexture = m_textures.emplace_back();
+		auto& mipTexture = m_textures[i];
+		const auto markReady = [&] {
+			if (!m_textureReady.empty())
+				m_textureReady[i].store(true, std::memory_order_release);
+		};
 
 		if (mipTextures[i].offsets[0] == 0) {
 			// texture is stored externally
-			if (auto tex = LoadTextureFromWads(mipTextures[i].name))
-				mipTexture = std::move(*tex);
-			else {
+			mipTexture = LoadTextureFromWads({mipTextures[i].name, strnlen(mipTextures[i].name, bsp30::MAXTEXTURENAME)});
+			if (!mipTexture) {
 				std::clog << "Failed to load texture " << mipTextures[i].name << " from WAD files\n";
-				continue;
+				errors++;
+				markReady(); // stays null
+				return;
 			}
 		} else {
-			// internal texture
+			// internal texture, shared by content only
 			const auto dataSize = sizeof(uint8_t) * (mipTextures[i].offsets[3] + (mipTextures[i].height / 8) * (mipTextures[i].width / 8) + 2 + 768);
-			std::vector<uint8_t> imgData(dataSize);
+			const auto imgData = m_file.view<uint8_t>(header.lump[bsp30::LumpType::LUMP_TEXTURES].offset + mipTextureOffsets[i], dataSize);
 
-			file.seekg(header.lump[bsp30::LumpType::LUMP_TEXTURES].offset + mipTextureOffsets[i]);
-			readVector(file, imgData);
-
-			Wad::CreateMipTexture(imgData, mipTexture);
+			mipTexture = TextureStore::shared().texture({}, mipTextures[i].name, imgData, worldTextureKind());
 		}
-	}
+		markReady();
+	});
 
 	UnloadWadFiles();
 
@@ -91,46 +131,51 @@ void Bsp::LoadTextures(std::ifstream& file) {
 		std::clog << "OK\n";
 	else
 		std::clog << "ERRORS\n";
+}
 
-	// calculate texture coordinates
-	faceTexCoords.resize(faces.size());
-	for (int i = 0; i < faces.size(); ++i) {
-		faceTexCoords[i].texCoords.resize(faces[i].edgeCount);
-
+void Bsp::ComputeTexCoords(ThreadPool& pool) {
+	pool.parallelFor(faces.size(), [&](std::size_t i) {
+		const auto texCoords = faceTexCoords.texCoordsOf(i);
 		const auto& curTexInfo = textureInfos[faces[i].textureInfo];
 
 		for (int j = 0; j < faces[i].edgeCount; j++) {
 			int edgeIndex = surfEdges[faces[i].firstEdgeIndex + j]; // This gives the index into the edge lump
 			if (edgeIndex > 0) {
-				faceTexCoords[i].texCoords[j].s = (glm::dot(vertices[edges[edgeIndex].vertexIndex[0]], curTexInfo.s) + curTexInfo.sShift) / mipTextures[curTexInfo.miptexIndex].width;
-				faceTexCoords[i].texCoords[j].t = (glm::dot(vertices[edges[edgeIndex].vertexIndex[0]], curTexInfo.t) + curTexInfo.tShift) / mipTextures[curTexInfo.miptexIndex].height;
+				texCoords[j].s = (glm::dot(vertices[edges[edgeIndex].vertexIndex[0]], curTexInfo.s) + curTexInfo.sShift) / mipTextures[curTexInfo.miptexIndex].width;
+				texCoords[j].t = (glm::dot(vertices[edges[edgeIndex].vertexIndex[0]], curTexInfo.t) + curTexInfo.tShift) / mipTextures[curTexInfo.miptexIndex].height;
 			} else {
 				edgeIndex *= -1;
-				faceTexCoords[i].texCoords[j].s = (glm::dot(vertices[edges[edgeIndex].vertexIndex[1]], curTexInfo.s) + curTexInfo.sShift) / mipTextures[curTexInfo.miptexIndex].width;
-				faceTexCoords[i].texCoords[j].t = (glm::dot(vertices[edges[edgeIndex].vertexIndex[1]], curTexInfo.t) + curTexInfo.tShift) / mipTextures[curTexInfo.miptexIndex].height;
+				texCoords[j].s = (glm::dot(vertices[edges[edgeIndex].vertexIndex[1]], curTexInfo.s) + curTexInfo.sShift) / mipTextures[curTexInfo.miptexIndex].width;
+				texCoords[j].t = (glm::dot(vertices[edges[edgeIndex].vertexIndex[1]], curTexInfo.t) + curTexInfo.tShift) / mipTextures[curTexInfo.miptexIndex].height;
 			}
 		}
-	}
+	});
 }
 
-auto Bsp::LoadTextureFromWads(const char* name) -> std::optional<MipmapTexture> {
-	for (auto& wad : wadFiles)
-		if (auto pMipMapTex = wad.loadTexture(name))
-			return pMipMapTex;
-	return {};
+auto Bsp::LoadTextureFromWads(std::string_view name) const -> std::shared_ptr<const MipmapTexture> {
+	const auto it = wadTextureIndex.find(name);
+	if (it == end(wadTextureIndex))
+		return {};
+	const auto& [wad, entry] = it->second;
+	return TextureStore::shared().texture(wadPaths[wad].generic_string(), name, wadFiles[wad].GetTexture(entry), worldTextureKind());
 }
 
-auto Bsp::LoadDecalTexture(const char* name) -> std::optional<MipmapTexture> {
-	for (auto& decalWad : decalWads)
-		if (auto pMipMapTex = decalWad.LoadDecalTexture(name))
-			return pMipMapTex;
+auto Bsp::LoadDecalTexture(std::string_view name) const -> std::shared_ptr<const MipmapTexture> {
+	auto& store = TextureStore::shared();
+	for (const auto& path : DECAL_WADS)
+		if (const auto rawTexture = store.wad(path).GetTexture(name); !rawTexture.empty())
+			return store.texture(path.generic_string(), name, rawTexture, TextureKind::Decal);
 	return {};
 }
 
+void Bsp::LoadDecalWads() {
+	// opened once per process
+	for (const auto& path : DECAL_WADS)
+		TextureStore::shared().wad(path);
+}
+
 void Bsp::LoadDecals() {
-	// load Decal WADs
-	decalWads.emplace_back(WAD_DIR / "valve/decals.wad");
-	decalWads.emplace_back(WAD_DIR / "cstrike/decals.wad");
+	std::clog << "Loading decals ...\n";
 
 	// Count decals
 	const auto& infodecals = FindEntities("infodecal");
@@ -140,17 +185,14 @@ void Bsp::LoadDecals() {
 	}
 
 	// Texture name table for texture loading
-	std::unordered_map<std::string, unsigned int> loadedTex;
+	std::unordered_map<std::string_view, unsigned int> loadedTex;
 
 	m_decals.reserve(infodecals.size());
 
 	// Process each decal
 	for (const auto& infodecal : infodecals) {
-		if (auto originStr = infodecal->findProperty("origin")) {
-			int x, y, z;
-			std::stringstream(*originStr) >> x >> y >> z;
-
-			const glm::vec3 origin{x, y, z};
+		if (const auto e = infodecal - &entities[0]; entityTable.hasOrigin[e]) {
+			const auto origin = entityTable.origin[e];
 			const auto leaf = findLeaf(origin);
 			if (!leaf) {
 				std::clog << "ERROR finding decal leaf\n";
@@ -186,17 +228,17 @@ void Bsp::LoadDecals() {
 					auto it = loadedTex.find(*texName);
 					if (it == end(loadedTex)) {
 						// Load new texture
-						auto mipTex = LoadDecalTexture(texName->c_str());
+						auto mipTex = LoadDecalTexture(*texName);
 						if (!mipTex) {
-							std::clog << "ERROR loading mipTexture " << texName << "\n";
+							std::clog << "ERROR loading mipTexture " << *texName << "\n";
 							break;
 						}
 						it = loadedTex.emplace(*texName, m_textures.size()).first;
-						m_textures.emplace_back(std::move(*mipTex));
+						m_textures.emplace_back(std::move(mipTex));
 					}
 
 					const auto& texIndex = it->second;
-					const auto& img0 = m_textures[texIndex].Img[0];
+					const auto& img0 = m_textures[texIndex]->Img[0];
 
 					const float h2 = img0.height / 2.0f;
 					const float w2 = img0.width / 2.0f;
@@ -221,13 +263,15 @@ void Bsp::LoadDecals() {
 	std::clog << "Loaded " << m_decals.size() << " decals, " << loadedTex.size() << " decal textures\n";
 }
 
-void Bsp::LoadLightMaps(const std::vector<std::uint8_t>& pLightMapData) {
-	std::int64_t loadedBytes = 0;
-	std::size_t loadedLightmaps = 0;
+void Bsp::LoadLightMaps(std::span<const std::uint8_t> pLightMapData, ThreadPool& pool) {
+	std::atomic<std::int64_t> loadedBytes = 0;
+	std::atomic<std::size_t> loadedLightmaps = 0;
 
-	for (int i = 0; i < faces.size(); i++) {
-		if (faces[i].styles[0] == 0 && static_cast<signed>(faces[i].lightmapOffset) >= -1) {
-			faceTexCoords[i].lightmapCoords.resize(faces[i].edgeCount);
+	m_lightmapTexels = pLightMapData;
+	m_lightmaps.resize(faces.size());
+	pool.parallelFor(faces.size(), [&](std::size_t i) {
+		if (faces[i].styles[0] == 0 && static_cast<signed>(faces[i].lightmapOffset) >= 0) {
+			const auto lightmapCoords = faceTexCoords.lightmapCoordsOf(i);
 
 			/* *********** QRAD ********** */
 
@@ -291,20 +335,23 @@ void Bsp::LoadLightMaps(const std::vector<std::uint8_t>& pLightMapData) {
 				float fLightMapU = fMidTexU + (fU - fMidPolyU) / 16.0f;
 				float fLightMapV = fMidTexV + (fV - fMidPolyV) / 16.0f;
 
-				faceTexCoords[i].lightmapCoords[j].s = fLightMapU / static_cast<float>(nWidth);
-				faceTexCoords[i].lightmapCoords[j].t = fLightMapV / static_cast<float>(nHeight);
+				lightmapCoords[j].s = fLightMapU / static_cast<float>(nWidth);
+				lightmapCoords[j].t = fLightMapV / static_cast<float>(nHeight);
 			}
 
 			/* ********** end http://www.gamedev.net/community/forums/topic.asp?topic_id=538713 ********** */
 
-			Image& image = m_lightmaps.emplace_back(nWidth, nHeight, 3);
-			memcpy(image.data.data(), &pLightMapData[faces[i].lightmapOffset], nWidth * nHeight * 3 * sizeof(unsigned char));
+			const auto size = static_cast<std::size_t>(nWidth) * nHeight * 3;
+			if (faces[i].lightmapOffset > pLightMapData.size() || size > pLightMapData.size() - faces[i].lightmapOffset) {
+				std::clog << "Lightmap of face " << i << " exceeds the lighting lump\n";
+				return;
+			}
+			m_lightmaps[i] = {faces[i].lightmapOffset, static_cast<std::uint32_t>(nWidth), static_cast<std::uint32_t>(nHeight)};
 
 			loadedLightmaps++;
 			loadedBytes += nWidth * nHeight * 3;
-		} else
-			m_lightmaps.emplace_back();
-	}
+		}
+	});
 
 	std::clog << "Loaded " << loadedLightmaps << " lightmaps, lightmapdatadiff: " << loadedBytes - header.lump[bsp30::LumpType::LUMP_LIGHTING].length << " bytes ";
 	if ((loadedBytes - header.lump[bsp30::LumpType::LUMP_LIGHTING].length) == 0)
@@ -313,11 +360,13 @@ void Bsp::LoadLightMaps(const std::vector<std::uint8_t>& pLightMapData) {
 		std::clog << "ERRORS\n";
 }
 
-void Bsp::LoadModels(std::ifstream& file) {
-	std::vector<bsp30::Model> submodels;
-	submodels.resize(header.lump[bsp30::LumpType::LUMP_MODELS].length / sizeof(bsp30::Model));
-	file.seekg(header.lump[bsp30::LumpType::LUMP_MODELS].offset);
-	readVector(file, submodels);
+auto Bsp::lightmapTexels(std::size_t face) const -> std::span<const std::uint8_t> {
+	const auto& lm = m_lightmaps[face];
+	return m_lightmapTexels.subspan(lm.offset, static_cast<std::size_t>(lm.width) * lm.height * 3);
+}
+
+void Bsp::LoadModels() {
+	const auto submodels = m_file.lumpView<bsp30::Model>(header.lump[bsp30::LumpType::LUMP_MODELS].offset, header.lump[bsp30::LumpType::LUMP_MODELS].length);
 
 	// hull 0 is created from normal BSP nodes
 	{
@@ -399,7 +448,7 @@ void Bsp::LoadModels(std::ifstream& file) {
 
 // Checks if an entity is a valid brush entity (has a model)
 auto IsBrushEntity(const Entity& e) -> bool {
-	if (e.findProperty("model") != nullptr) {
+	if (e.findProperty("model")) {
 		if (auto classname = e.findProperty("classname")) {
 			if (*classname == "func_door_rotating" ||
 				*classname == "func_door" ||
@@ -414,16 +463,33 @@ auto IsBrushEntity(const Entity& e) -> bool {
 	return false;
 }
 
-void Bsp::ParseEntities(const std::string& entitiesString) {
-	std::size_t pos = 0;
-	while (true) {
-		pos = entitiesString.find('{', pos);
-		if (pos == std::string::npos)
-			break;
-
-		auto end = entitiesString.find('}', pos);
-		entities.emplace_back(entitiesString.substr(pos + 1, end - pos - 1));
-		pos = end + 1;
+void Bsp::ParseEntities(std::string_view entityLump) {
+	entities = parseEntities(entityLump, entityProperties);
+
+	auto& t = entityTable;
+	t.model.resize(entities.size(), -1);
+	t.origin.resize(entities.size());
+	t.hasOrigin.resize(entities.size());
+	t.renderMode.resize(entities.size(), bsp30::RENDER_MODE_NORMAL);
+	t.renderAmount.resize(entities.size(), 1.0f);
+	t.angle.resize(entities.size());
+
+	for (auto i = 0u; i < entities.size(); i++) {
+		for (const auto& [key, value] : entities[i].properties()) {
+			if (key == "classname")
+				entitiesByClassname[value].push_back(i);
+			else if (key == "model" && value.starts_with('*'))
+				t.model[i] = parseInt(value.substr(1));
+			else if (key == "origin") {
+				t.origin[i] = parseVec3(value);
+				t.hasOrigin[i] = true;
+			} else if (key == "rendermode")
+				t.renderMode[i] = static_cast<bsp30::RenderMode>(parseInt(value));
+			else if (key == "renderamt")
+				t.renderAmount[i] = parseInt(value) / 255.0f;
+			else if (key == "angle")
+				t.angle[i] = parseFloat(value);
+		}
 	}
 }
 
@@ -443,36 +509,38 @@ void Bsp::CountVisLeafs(int iNode, int& count) {
 	CountVisLeafs(nodes[iNode].childIndex[1], count);
 }
 
-auto Bsp::decompressVIS(int leaf, const std::vector<std::uint8_t>& compressedVis) const -> boost::dynamic_bitset<std::uint8_t> {
-	boost::dynamic_bitset<std::uint8_t> pvs;
-	pvs.reserve(leaves.size() - 1);
-
-	const auto* read = &compressedVis[leaves[leaf].visOffset];
-	//const auto* end = compressedVis.data() + (leaves[leaf + 1].visOffset == -1 ? header.lump[bsp30::LUMP_VISIBILITY].length : leaves[leaf + 1].visOffset);
-
-	const auto row = (visLists.size() + 7) / 8;
-	while (pvs.size() / 8 < row) {
-		if (*read)
-			pvs.append(*read);
-		else {
-			// run of 0s, number of 0s is stored in next byte
-			read++;
-			for (auto i = 0; i < *read; i++) {
-				pvs.append(0x00);
-				if (pvs.size() / 8 >= row)
-					break;
-			}
-		}
-
-		read++;
+void Bsp::LoadVisLists() {
+	if (header.lump[bsp30::LumpType::LUMP_VISIBILITY].length == 0) {
+		std::clog << "No VIS found\n";
+		return;
 	}
 
-	//std::clog << "PVS for leaf " << leaf << "\n";
-	//std::clog << "read: " << (void*)read << "\n";
-	//std::clog << "end:  " << (void*)end << "\n";
-	//std::clog << "diff: " << (end - read) << "\n";
+	int count = 0;
+	CountVisLeafs(0, count);
+
+	// the compressed lump stays mapped, rows are only decompressed when a leaf is visited
+	visCache.load(m_file.lumpView<std::uint8_t>(header.lump[bsp30::LumpType::LUMP_VISIBILITY].offset, header.lump[bsp30::LumpType::LUMP_VISIBILITY].length), leaves, count);
+	visCache.setBudget(global::visCacheBytes);
+}
+
+void Bsp::ClassifyEntities() {
+	// create brush and special entities
+	for (auto& e : entities) {
+		const auto i = &e - &entities[0];
+		if (IsBrushEntity(e) && entityTable.model[i] >= 0 && entityTable.model[i] < static_cast<int>(models.size())) {
+			brushEntities.push_back(static_cast<unsigned int>(i));
+
+			// if entity has property "origin" apply to model struct for rendering
+			if (entityTable.hasOrigin[i])
+				models[entityTable.model[i]].origin = entityTable.origin[i]; // TODO
+		} else
+			specialEntities.push_back(static_cast<unsigned int>(&e - &entities[0]));
+	}
 
-	return pvs;
+	// order brush entities so that those with RENDER_MODE_TEXTURE are at the back
+	std::partition(begin(brushEntities), end(brushEntities), [this](unsigned int i) {
+		return entityTable.renderMode[i] != bsp30::RENDER_MODE_TEXTURE;
+	});
 }
 
 auto Bsp::findLeaf(glm::vec3 pos, int node) const -> std::optional<int> {
@@ -494,181 +562,152 @@ auto Bsp::findLeaf(glm::vec3 pos, int node) const -> std::optional<int> {
 	return {};
 }
 
-Bsp::Bsp(const fs::path& filename) {
-	std::ifstream file(filename, std::ios::binary);
-	if (!file)
-		throw std::ios::failure("Failed to open file " + filename.string() + " for reading");
-
+Bsp::Bsp(const fs::path& filename, LoadOptions options)
+	: m_file(openFile(filename)), m_profile(options.profile) {
 	std::clog << "LOADING BSP FILE: " << filename << "\n";
 
 	// Read in the header
-	read(file, header);
+	header = m_file.read<bsp30::Header>(0);
 	if (header.version != 30)
 		throw std::runtime_error("Invalid BSP version (" + std::to_string(header.version) + ") instead of 30)");
 
 	// =================================================================
-	// Get number of elements and allocate memory for them
+	// Create views into the mapped lumps, nothing is copied
 	// =================================================================
 
-	nodes.resize(header.lump[bsp30::LumpType::LUMP_NODES].length / sizeof(bsp30::Node));
-	leaves.resize(header.lump[bsp30::LumpType::LUMP_LEAFS].length / sizeof(bsp30::Leaf));
-	markSurfaces.resize(header.lump[bsp30::LumpType::LUMP_MARKSURFACES].length / sizeof(bsp30::MarkSurface));
-	faces.resize(header.lump[bsp30::LumpType::LUMP_FACES].length / sizeof(bsp30::Face));
-	clipNodes.resize(header.lump[bsp30::LumpType::LUMP_CLIPNODES].length / sizeof(bsp30::ClipNode));
-	surfEdges.resize(header.lump[bsp30::LumpType::LUMP_SURFEDGES].length / sizeof(bsp30::SurfEdge));
-	edges.resize(header.lump[bsp30::LumpType::LUMP_EDGES].length / sizeof(bsp30::Edge));
-	vertices.resize(header.lump[bsp30::LumpType::LUMP_VERTEXES].length / sizeof(bsp30::Vertex));
-	planes.resize(header.lump[bsp30::LumpType::LUMP_PLANES].length / sizeof(bsp30::Plane));
+	const auto lumpView = [&]<typename T>(bsp30::LumpType type, std::span<const T>& view) {
+		view = m_file.lumpView<T>(header.lump[type].offset, header.lump[type].length);
+	};
+
+	lumpView(bsp30::LumpType::LUMP_NODES, nodes);
+	lumpView(bsp30::LumpType::LUMP_LEAFS, leaves);
+	lumpView(bsp30::LumpType::LUMP_MARKSURFACES, markSurfaces);
+	lumpView(bsp30::LumpType::LUMP_FACES, faces);
+	lumpView(bsp30::LumpType::LUMP_CLIPNODES, clipNodes);
+	lumpView(bsp30::LumpType::LUMP_SURFEDGES, surfEdges);
+	lumpView(bsp30::LumpType::LUMP_EDGES, edges);
+	lumpView(bsp30::LumpType::LUMP_VERTEXES, vertices);
+	lumpView(bsp30::LumpType::LUMP_PLANES, planes);
+
+	lumpView(bsp30::LumpType::LUMP_TEXINFO, textureInfos);
+
+	const auto full = m_profile == LoadProfile::Full;
+	if (full) {
+		const auto texturesOffset = header.lump[bsp30::LumpType::LUMP_TEXTURES].offset;
+		textureHeader = m_file.read<bsp30::TextureHeader>(texturesOffset);
+		mipTextureOffsets = m_file.view<bsp30::MipTexOffset>(texturesOffset + sizeof(bsp30::TextureHeader), textureHeader.mipTextureCount);
+
+		mipTextures.resize(textureHeader.mipTextureCount);
+		for (unsigned int i = 0; i < textureHeader.mipTextureCount; i++)
+			mipTextures[i] = m_file.read<bsp30::MipTex>(texturesOffset + mipTextureOffsets[i]);
+
+		if (options.useCache)
+			m_cache = BspCache::open(BspCache::pathFor(filename));
+	}
 
 	// =================================================================
-	// Seek to and read in the data
+	// Run the remaining load stages as soon as their inputs are ready
 	// =================================================================
 
-	file.seekg(header.lump[bsp30::LumpType::LUMP_NODES].offset);
-	readVector(file, nodes);
-
-	file.seekg(header.lump[bsp30::LumpType::LUMP_LEAFS].offset);
-	readVector(file, leaves);
+	auto& pool = ThreadPool::shared();
+	TaskGraph graph;
 
-	file.seekg(header.lump[bsp30::LumpType::LUMP_MARKSURFACES].offset);
-	readVector(file, markSurfaces);
-
-	file.seekg(header.lump[bsp30::LumpType::LUMP_FACES].offset);
-	readVector(file, faces);
-
-	file.seekg(header.lump[bsp30::LumpType::LUMP_CLIPNODES].offset);
-	readVector(file, clipNodes);
-
-	file.seekg(header.lump[bsp30::LumpType::LUMP_SURFEDGES].offset);
-	readVector(file, surfEdges);
-
-	file.seekg(header.lump[bsp30::LumpType::LUMP_EDGES].offset);
-	readVector(file, edges);
-
-	file.seekg(header.lump[bsp30::LumpType::LUMP_VERTEXES].offset);
-	readVector(file, vertices);
-
-	file.seekg(header.lump[bsp30::LumpType::LUMP_PLANES].offset);
-	readVector(file, planes);
-
-	LoadModels(file);
-
-	// ===========================
-	// Entity Operations
-	// ===========================
-
-	std::string entityBuffer;
-	entityBuffer.resize(header.lump[bsp30::LumpType::LUMP_ENTITIES].length);
-	file.seekg(header.lump[bsp30::LumpType::LUMP_ENTITIES].offset);
-	file.read(entityBuffer.data(), entityBuffer.size());
-	ParseEntities(std::move(entityBuffer));
-
-	// ===========================
-	// Texture Operations
-	// ===========================
-
-	textureInfos.resize(header.lump[bsp30::LumpType::LUMP_TEXINFO].length / sizeof(bsp30::TextureInfo));
-	file.seekg(header.lump[bsp30::LumpType::LUMP_TEXINFO].offset);
-	readVector(file, textureInfos);
-
-	file.seekg(header.lump[bsp30::LumpType::LUMP_TEXTURES].offset);
-	read(file, textureHeader);
-
-	mipTextures.resize(textureHeader.mipTextureCount);
-	mipTextureOffsets.resize(textureHeader.mipTextureCount);
-	readVector(file, mipTextureOffsets);
-
-	for (unsigned int i = 0; i < textureHeader.mipTextureCount; i++) {
-		file.seekg(header.lump[bsp30::LumpType::LUMP_TEXTURES].offset + mipTextureOffsets[i]);
-		read(file, mipTextures[i]);
-	}
-
-	// Load in the texture images and calculate the texture cordinates for each vertex to save render time
-	LoadTextures(file);
-
-	// ===========================
-	// Lightmap Operations
-	// ===========================
-
-	std::clog << "Loading lightmaps ...\n";
-	if (header.lump[bsp30::LumpType::LUMP_LIGHTING].length == 0)
-		std::clog << "No lightmapdata found\n";
-	else {
-		std::vector<std::uint8_t> pLightMapData(header.lump[bsp30::LumpType::LUMP_LIGHTING].length);
-		file.seekg(header.lump[bsp30::LumpType::LUMP_LIGHTING].offset);
-		readVector(file, pLightMapData);
+	const auto entitiesTask = graph.add("entities", [&] {
+		const auto entityLump = m_file.lumpView<char>(header.lump[bsp30::LumpType::LUMP_ENTITIES].offset, header.lump[bsp30::LumpType::LUMP_ENTITIES].length);
+		ParseEntities({entityLump.data(), entityLump.size()});
+	});
+	const auto modelsTask = graph.add("models", [&] { LoadModels(); });
+	graph.add("brushents", [&] { ClassifyEntities(); }, {entitiesTask, modelsTask});
+
+	if (m_cache) {
+		// everything derived from textures, lightmaps and VIS is precompiled
+		graph.add("cache", [&] {
+			m_textures = m_cache->textures();
+			const auto decals = m_cache->decals();
+			m_decals.assign(decals.begin(), decals.end());
+			visCache.load(m_cache->visRows(), m_cache->visRows().size());
+			visCache.setBudget(global::visCacheBytes);
+		});
+	} else if (m_profile != LoadProfile::Collision)
+		graph.add("vis", [&] { LoadVisLists(); });
+
+	if (full && !m_cache) {
+		// coordinates of all face vertices live in two flat arrays
+		faceTexCoords.offsets.resize(faces.size() + 1);
+		for (auto i = 0u; i < faces.size(); i++)
+			faceTexCoords.offsets[i + 1] = faceTexCoords.offsets[i] + faces[i].edgeCount;
+		faceTexCoords.texCoords.resize(faceTexCoords.offsets.back());
+		faceTexCoords.lightmapCoords.resize(faceTexCoords.offsets.back());
+
+		const auto wadsTask = graph.add("wads", [&] {
+			std::clog << "Loading WADs ...\n";
+			if (const auto worldSpawn = FindEntity("worldspawn"))
+				if (const auto wad = worldSpawn->findProperty("wad"))
+					LoadWadFiles(std::string{*wad});
+		}, {entitiesTask});
+		// world textures come first in m_textures, decals append theirs
+		m_textures.resize(textureHeader.mipTextureCount);
+		const auto texturesTask = options.progressive
+			? graph.add("textures", [&] { m_textureReady = std::vector<std::atomic<bool>>(textureHeader.mipTextureCount); }) // decoded after the graph
+			: graph.add("textures", [&] { LoadTextures(pool); }, {wadsTask});
+		graph.add("texcoords", [&] { ComputeTexCoords(pool); });
+
+		graph.add("lightmaps", [&] {
+			std::clog << "Loading lightmaps ...\n";
+			if (header.lump[bsp30::LumpType::LUMP_LIGHTING].length == 0)
+				std::clog << "No lightmapdata found\n";
+			else
+				LoadLightMaps(m_file.lumpView<std::uint8_t>(header.lump[bsp30::LumpType::LUMP_LIGHTING].offset, header.lump[bsp30::LumpType::LUMP_LIGHTING].length), pool);
+		});
 
-		LoadLightMaps(pLightMapData);
+		const auto decalWadsTask = graph.add("decalwads", [&] { LoadDecalWads(); });
+		graph.add("decals", [&] { LoadDecals(); }, {entitiesTask, texturesTask, decalWadsTask}); // decal textures are appended to m_textures
 	}
 
-	// ===========================
-	// Decal Operations
-	// ===========================
-
-	std::clog << "Loading decals ...\n";
-	LoadDecals();
-
-	// ===========================
-	// Visibility List Operations
-	// ===========================
-
-	if (header.lump[bsp30::LumpType::LUMP_VISIBILITY].length > 0) {
-		// Allocate memory for the compressed vis lists
-		std::vector<std::uint8_t> compressedVis(header.lump[bsp30::LumpType::LUMP_VISIBILITY].length);
-
-		file.seekg(header.lump[bsp30::LumpType::LUMP_VISIBILITY].offset);
-		readVector(file, compressedVis);
-
-		std::clog << "Decompressing VIS ...\n";
-
-		int count = 0;
-		CountVisLeafs(0, count);
+	graph.run(pool);
 
-		visLists.resize(count);
+	std::clog << "Load stages:\n";
+	graph.logTimings(std::clog);
 
-		for (int i = 0; i < count; i++) {
-			if (leaves[i + 1].visOffset >= 0)
-				visLists[i] = decompressVIS(i + 1, compressedVis);
-		}
-	} else
-		std::clog << "No VIS found\n";
+	sourceFiles.push_back(filename);
+	sourceFiles.insert(end(sourceFiles), begin(wadPaths), end(wadPaths));
+	if (full)
+		for (const auto& path : DECAL_WADS)
+			sourceFiles.push_back(path);
 
-	file.close();
-
-	// create brush and special entities
-	for (auto& e : entities) {
-		if (IsBrushEntity(e)) {
-			brushEntities.push_back(static_cast<unsigned int>(&e - &entities[0]));
-
-			// if entity has property "origin" apply to model struct for rendering
-			if (auto szOrigin = e.findProperty("origin")) {
-				const int iModel = std::atoi(&e.findProperty("model")->c_str()[1]);
-				auto& origin = models[iModel].origin; // TODO
-				sscanf(szOrigin->c_str(), "%f %f %f", &origin.x, &origin.y, &origin.z);
+	if (!m_textureReady.empty()) {
+		// geometry, lightmaps, VIS and decals are complete, the map can be drawn while the WAD textures are decoded
+		m_textureLoad = std::async(std::launch::async, [this, &pool] {
+			try {
+				LoadTextures(pool);
+			} catch (const std::exception& e) {
+				std::clog << "Loading textures failed: " << e.what() << "\n";
 			}
-		} else
-			specialEntities.push_back(static_cast<unsigned int>(&e - &entities[0]));
+		});
+		std::clog << "FINISHED LOADING BSP, textures are loaded in the background\n";
+		return;
 	}
 
-	// order brush entities so that those with RENDER_MODE_TEXTURE are at the back
-	std::partition(begin(brushEntities), end(brushEntities), [this](unsigned int i) {
-		if (auto szRenderMode1 = entities[i].findProperty("rendermode"))
-			if (static_cast<bsp30::RenderMode>(std::stoi(*szRenderMode1)) == bsp30::RENDER_MODE_TEXTURE)
-				return false;
-		return true;
-	});
-
 	std::clog << "FINISHED LOADING BSP\n";
 }
 
-Bsp::~Bsp() = default;
+Bsp::~Bsp() {
+	m_cancelTextureLoad = true;
+	if (m_textureLoad.valid())
+		m_textureLoad.wait();
+}
+
+auto Bsp::textureReady(std::size_t i) const -> bool {
+	return i >= m_textureReady.size() || m_textureReady[i].load(std::memory_order_acquire);
+}
+
+auto Bsp::texturesPending() const -> bool {
+	return m_textureLoad.valid() && m_textureLoad.wait_for(std::chrono::seconds{0}) != std::future_status::ready;
+}
 
 auto Bsp::FindEntity(std::string_view name) -> Entity* {
-	for (auto& e : entities)
-		if (auto classname = e.findProperty("classname"))
-			if (*classname == name)
-				return &e;
-	return nullptr;
+	const auto it = entitiesByClassname.find(name);
+	return it != end(entitiesByClassname) ? &entities[it->second.front()] : nullptr;
 }
 
 auto Bsp::FindEntity(std::string_view name) const -> const Entity* {
@@ -677,24 +716,34 @@ auto Bsp::FindEntity(std::string_view name) const -> const Entity* {
 
 std::vector<Entity*> Bsp::FindEntities(std::string_view name) {
 	std::vector<Entity*> result;
-	for (auto& e : entities)
-		if (auto classname = e.findProperty("classname"))
-			if (*classname == name)
-				result.push_back(&e);
+	if (const auto it = entitiesByClassname.find(name); it != end(entitiesByClassname))
+		for (const auto i : it->second)
+			result.push_back(&entities[i]);
 	return result;
 }
 
-auto Bsp::loadSkyBox() const -> std::optional<std::array<Image, 6>> {
+auto Bsp::skyBoxFiles() const -> std::optional<std::array<fs::path, 6>> {
 	const auto worldspawn = FindEntity("worldspawn");
 	if (worldspawn == nullptr)
 		return {};
 	const auto skyname = worldspawn->findProperty("skyname");
-	if (skyname == nullptr)
+	if (!skyname)
 		return {}; // we don't have a sky texture
 
 	char size[6][3] = {"ft", "bk", "up", "dn", "rt", "lf"};
+	std::array<fs::path, 6> result;
+	for (auto i = 0; i < 6; i++)
+		result[i] = SKY_DIR / (std::string{*skyname} + size[i] + ".tga");
+	return result;
+}
+
+auto Bsp::loadSkyBox() const -> std::optional<std::array<Image, 6>> {
+	const auto files = skyBoxFiles();
+	if (!files)
+		return {};
+
 	std::array<Image, 6> result;
 	for (auto i = 0; i < 6; i++)
-		result[i] = Image(SKY_DIR / (*skyname + size[i] + ".tga"));
+		result[i] = Image((*files)[i]);
 	return result;
 }
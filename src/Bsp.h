@@ -1,18 +1,39 @@
 #pragma once
 
-#include <boost/dynamic_bitset.hpp>
-
+#include <atomic>
+#include <future>
+#include <memory>
 #include <optional>
+#include <span>
 #include <string_view>
+#include <unordered_map>
 
 #include "bspdef.h"
 #include "Entity.h"
 #include "Wad.h"
 #include "IO.h"
+#include "Vis.h"
+
+class BspCache;
+class ThreadPool;
 
+// Texture and lightmap coordinates of all face vertices in two flat arrays. The vertices of face i are [offsets[i], offsets[i + 1]).
 struct FaceTexCoords {
+	std::vector<unsigned int> offsets;
 	std::vector<glm::vec2> texCoords;
-	std::vector<glm::vec2> lightmapCoords;
+	std::vector<glm::vec2> lightmapCoords; // (0, 0) for faces without a lightmap
+
+	auto texCoordsOf(std::size_t face) -> std::span<glm::vec2> { return {texCoords.data() + offsets[face], offsets[face + 1] - offsets[face]}; }
+	auto texCoordsOf(std::size_t face) const -> std::span<const glm::vec2> { return {texCoords.data() + offsets[face], offsets[face + 1] - offsets[face]}; }
+	auto lightmapCoordsOf(std::size_t face) -> std::span<glm::vec2> { return {lightmapCoords.data() + offsets[face], offsets[face + 1] - offsets[face]}; }
+	auto lightmapCoordsOf(std::size_t face) const -> std::span<const glm::vec2> { return {lightmapCoords.data() + offsets[face], offsets[face + 1] - offsets[face]}; }
+};
+
+// Location of the RGB lightmap of a face in Bsp::m_lightmapTexels
+struct FaceLightmap {
+	std::uint32_t offset = 0;
+	std::uint32_t width = 0; // 0 if the face has no lightmap
+	std::uint32_t height = 0;
 };
 
 struct Decal {
@@ -21,9 +42,19 @@ struct Decal {
 	glm::vec3 vec[4];
 };
 
+// Frequently used entity properties, parsed once at load. Every array is indexed like Bsp::entities.
+struct EntityTable {
+	std::vector<int> model;                     // brush model index, -1 if the entity has none
+	std::vector<glm::vec3> origin;              // (0, 0, 0) if not set
+	std::vector<bool> hasOrigin;
+	std::vector<bsp30::RenderMode> renderMode;  // RENDER_MODE_NORMAL if not set
+	std::vector<float> renderAmount;            // renderamt in [0, 1], 1 if not set
+	std::vector<float> angle;                   // yaw in degrees, 0 if not set
+};
+
 struct Hull {
-	bsp30::ClipNode* clipnodes;
-	bsp30::Plane* planes;
+	const bsp30::ClipNode* clipnodes;
+	const bsp30::Plane* planes;
 	int firstclipnode;
 	int lastclipnode;
 	glm::vec3 clipMins;
@@ -34,64 +65,111 @@ struct Model : bsp30::Model {
 	std::array<Hull, bsp30::MAX_MAP_HULLS> hulls;
 };
 
+enum class LoadProfile {
+	Collision,  // planes, nodes, clipnodes, leaves, models and entities, enough for playerMove
+	Visibility, // additionally the PVS
+	Full        // everything needed for rendering, including WAD textures, lightmaps and decals
+};
+
+struct LoadOptions {
+	LoadProfile profile = LoadProfile::Full;
+	bool useCache = true;     // use the runtime cache next to the file if it is up to date (full profile only)
+	bool progressive = false; // return before the WAD textures are decoded, they become ready one by one in the background
+};
+
 class Bsp {
 public:
-	explicit Bsp(const fs::path& filename);
-	~Bsp();
+	explicit Bsp(const fs::path& filename, LoadOptions options = {});
+	~Bsp(); // cancels and waits for a progressive texture load
+
+	auto profile() const -> LoadProfile { return m_profile; }
+	auto runtimeCache() const -> const BspCache* { return m_cache.get(); } // nullptr if the map was loaded from its source files
+
+	auto textureReady(std::size_t i) const -> bool; // true if m_textures[i] is decoded and may be read
+	auto texturesPending() const -> bool;           // true while textures are still decoded in the background
 
-	auto FindEntity(std::string_view name) -> Entity*;
+	auto FindEntity(std::string_view name) -> Entity*; // first entity of the given classname
 	auto FindEntity(std::string_view name) const -> const Entity*;
 	auto FindEntities(std::string_view name) -> std::vector<Entity*>;
 
+	auto skyBoxFiles() const -> std::optional<std::array<fs::path, 6>>; // ft, bk, up, dn, rt, lf
 	auto loadSkyBox() const -> std::optional<std::array<Image, 6>>;
 
-	bsp30::Header header{};                       // Stores the header
-	std::vector<bsp30::Vertex> vertices;          // Stores the vertices
-	std::vector<bsp30::Edge> edges;               // Stores the edges
-	std::vector<bsp30::SurfEdge> surfEdges;       // Stores the surface edges
-	std::vector<bsp30::Node> nodes;               // Stores the nodes
-	std::vector<bsp30::Leaf> leaves;              // Stores the leafs
-	std::vector<bsp30::MarkSurface> markSurfaces; // Stores the marksurfaces
-	std::vector<bsp30::Plane> planes;             // Stores the planes
-	std::vector<bsp30::Face> faces;               // Stores the faces
-	std::vector<bsp30::ClipNode> clipNodes;
-	bsp30::TextureHeader textureHeader{};               // Stores the texture header
-	std::vector<bsp30::MipTex> mipTextures;             // Stores the miptextures
-	std::vector<bsp30::MipTexOffset> mipTextureOffsets; // Stores the miptexture offsets
-	std::vector<bsp30::TextureInfo> textureInfos;       // Stores the texture infos
-
-	std::vector<FaceTexCoords> faceTexCoords; // Stores precalculated texture and lightmap coordinates for every vertex
-
+	MappedFile m_file; // The mapped BSP file (from a mounted archive or the file system), all lump views below point into it
+
+	bsp30::Header header{};                           // Stores the header
+	std::span<const bsp30::Vertex> vertices;          // Stores the vertices
+	std::span<const bsp30::Edge> edges;               // Stores the edges
+	std::span<const bsp30::SurfEdge> surfEdges;       // Stores the surface edges
+	std::span<const bsp30::Node> nodes;               // Stores the nodes
+	std::span<const bsp30::Leaf> leaves;              // Stores the leafs
+	std::span<const bsp30::MarkSurface> markSurfaces; // Stores the marksurfaces
+	std::span<const bsp30::Plane> planes;             // Stores the planes
+	std::span<const bsp30::Face> faces;               // Stores the faces
+	std::span<const bsp30::ClipNode> clipNodes;
+	bsp30::TextureHeader textureHeader{};                   // Stores the texture header
+	std::vector<bsp30::MipTex> mipTextures;                 // Stores the miptextures
+	std::span<const bsp30::MipTexOffset> mipTextureOffsets; // Stores the miptexture offsets
+	std::span<const bsp30::TextureInfo> textureInfos;       // Stores the texture infos
+
+	FaceTexCoords faceTexCoords; // Stores precalculated texture and lightmap coordinates for every vertex
+
+	std::vector<EntityProperty> entityProperties; // views into the mapped entity lump
 	std::vector<Entity> entities;
+	std::unordered_map<std::string_view, std::vector<unsigned int>> entitiesByClassname; // indices into entities in lump order
+	EntityTable entityTable;
 	std::vector<unsigned int> brushEntities;   // Indices of brush entities in entities
 	std::vector<unsigned int> specialEntities; // IndicUnloadWadFileses of special entities in entities
 	std::vector<Wad> wadFiles;
-	std::vector<Wad> decalWads;
 	std::vector<Decal> m_decals;
-	std::vector<boost::dynamic_bitset<std::uint8_t>> visLists; // Stores the vis lists for all faces
+	VisCache visCache; // Decompresses the vis lists of leaves on demand
+
+	std::vector<std::shared_ptr<const MipmapTexture>> m_textures; // shared with other maps through the TextureStore, null if a texture failed to load
+	std::vector<FaceLightmap> m_lightmaps;         // one per face
+	std::span<const std::uint8_t> m_lightmapTexels; // all lightmaps, a view into the mapped lighting lump
 
-	std::vector<MipmapTexture> m_textures;
-	std::vector<Image> m_lightmaps;
+	auto lightmapTexels(std::size_t face) const -> std::span<const std::uint8_t>; // RGB texels of a face's lightmap, empty if it has none
 
 	std::vector<bsp30::ClipNode> hull0ClipNodes;
 	std::vector<Model> models;
 
+	std::vector<fs::path> sourceFiles; // BSP and WAD files the loaded data was derived from
+
 private:
-	void LoadWadFiles(std::string wadStr);                                      // Loads and prepares the wad files for further texture loading
-	void UnloadWadFiles();                                                      // Unloads all wad files and frees allocated memory
-	void LoadTextures(std::ifstream& file);                                     // Loads the textures either from the wad file or directly from the bsp file
-	auto LoadTextureFromWads(const char* name) -> std::optional<MipmapTexture>; // Finds and loads a texture from a wad file by the given name
-	auto LoadDecalTexture(const char* name) -> std::optional<MipmapTexture>;
+	void LoadWadFiles(std::string wadStr);                                        // Loads and prepares the wad files for further texture loading
+	void IndexWadFiles();                                                         // Merges the directories of the wad files into one name index
+	void UnloadWadFiles();                                                        // Unloads all wad files and frees allocated memory
+	void LoadTextures(ThreadPool& pool);                                          // Loads the textures either from the wad file or directly from the bsp file
+	void ComputeTexCoords(ThreadPool& pool);                                      // Calculates the texture coordinates of every face vertex
+	auto LoadTextureFromWads(std::string_view name) const -> std::shared_ptr<const MipmapTexture>; // Finds a texture in the wad files by the given name and decodes it
+	auto LoadDecalTexture(std::string_view name) const -> std::shared_ptr<const MipmapTexture>;
+	void LoadDecalWads();
 	void LoadDecals();
-	void LoadLightMaps(const std::vector<std::uint8_t>& pLightMapData); // Loads lightmaps and calculates extends and coordinates
-	void LoadModels(std::ifstream& file);
+	void LoadLightMaps(std::span<const std::uint8_t> pLightMapData, ThreadPool& pool); // Loads lightmaps and calculates extends and coordinates
+	void LoadModels();
+	void LoadVisLists(); // Prepares on demand decompression of the vis lists
 
-	void ParseEntities(const std::string& entitiesString); // Parses the entity lump of the bsp file into single entity classes
+	void ParseEntities(std::string_view entityLump); // Parses the entity lump of the bsp file into single entity classes
+	void ClassifyEntities();                               // Sorts entities into brush and special entities
 
-	void CountVisLeafs(int iNode, int& count);                                                                                 // Counts the number of visLeaves recursively
-	auto decompressVIS(int leaf, const std::vector<std::uint8_t>& compressedVis) const -> boost::dynamic_bitset<std::uint8_t>; // Get the PVS for a given leaf and return it in the form of a pointer to a bool array
+	void CountVisLeafs(int iNode, int& count); // Counts the number of visLeaves recursively
 
 	auto findLeaf(glm::vec3 pos, int node = 0) const -> std::optional<int>; // Recursivly walks through the BSP tree to find the leaf where the camera is in
 
+	struct WadTextureRef {
+		std::uint32_t wad;   // index into wadFiles
+		std::uint32_t entry; // directory entry in that WAD
+	};
+
+	LoadProfile m_profile;
+	std::vector<fs::path> wadPaths;
+	std::unordered_map<std::string_view, WadTextureRef, TextureNameHash, TextureNameEqual> wadTextureIndex; // merged directory of wadFiles, earlier WADs take precedence
+	std::unique_ptr<BspCache> m_cache;
+
+	std::vector<std::atomic<bool>> m_textureReady; // only used while loading progressively
+	std::atomic<bool> m_cancelTextureLoad = false;
+	std::future<void> m_textureLoad;
+
 	friend class BspRenderable;
+	friend class BspCache;
 };
@@ -0,0 +1,224 @@
+#include "BspCache.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include "Archive.h"
+#include "Bsp.h"
+#include "Hash.h"
+
+namespace {
+	constexpr char CACHE_MAGIC[4] = {'H', 'L', 'B', 'C'};
+	constexpr auto ALIGNMENT = 16; // arrays are aligned relative to the file start, which is page aligned when mapped
+
+	void pad(std::ostream& os) {
+		while (os.tellp() % ALIGNMENT != 0)
+			os.put(0);
+	}
+
+	template<typename T>
+	void writeArray(std::ostream& os, std::span<const T> v) {
+		write(os, static_cast<std::uint32_t>(v.size()));
+		pad(os);
+		writeVector(os, v);
+	}
+
+	void writeImage(std::ostream& os, ImageView img) {
+		if (!img.tight()) {
+			writeImage(os, Image{img}); // the cache stores tightly packed rows
+			return;
+		}
+		write(os, static_cast<std::uint32_t>(img.width));
+		write(os, static_cast<std::uint32_t>(img.height));
+		write(os, static_cast<std::uint32_t>(img.channels));
+		writeArray(os, img.bytes());
+	}
+
+	// Sequential reader over the mapped cache file
+	class Cursor {
+	public:
+		explicit Cursor(const MappedFile& file)
+			: m_file(file) {}
+
+		template<typename T>
+		auto read() -> T {
+			const auto t = m_file.read<T>(m_pos);
+			m_pos += sizeof(T);
+			return t;
+		}
+
+		template<typename T>
+		auto array() -> std::span<const T> {
+			const auto count = read<std::uint32_t>();
+			m_pos = (m_pos + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+			const auto v = m_file.view<T>(m_pos, count);
+			m_pos += count * sizeof(T);
+			return v;
+		}
+
+	private:
+		const MappedFile& m_file;
+		std::size_t m_pos = 0;
+	};
+
+	auto hashFile(const fs::path& path) -> std::uint64_t {
+		return fnv1a64(openFile(path).bytes());
+	}
+}
+
+auto BspCache::pathFor(const fs::path& bspPath) -> fs::path {
+	return fs::path(bspPath).replace_extension(".hlbspc");
+}
+
+void BspCache::write(const fs::path& path, const Bsp& bsp, const BspRenderable::StaticGeometry& geometry) {
+	std::clog << "Writing runtime cache " << path << " ...\n";
+
+	std::ofstream os(path, std::ios::binary);
+	if (!os)
+		throw std::ios::failure("Failed to open file " + path.string() + " for writing");
+	os.exceptions(std::ios::badbit | std::ios::failbit);
+
+	::write(os, CACHE_MAGIC);
+	::write(os, version);
+
+	::write(os, static_cast<std::uint32_t>(bsp.sourceFiles.size()));
+	for (const auto& source : bsp.sourceFiles) {
+		const auto name = source.generic_string();
+		const auto stamp = fileStamp(source).value_or(FileStamp{});
+		writeArray(os, std::span<const char>{name});
+		::write(os, stamp.size);
+		::write(os, stamp.modified);
+		::write(os, hashFile(source));
+	}
+
+	::write(os, static_cast<std::uint32_t>(bsp.m_textures.size()));
+	for (const auto& tex : bsp.m_textures) {
+		::write(os, static_cast<std::uint32_t>(tex != nullptr));
+		if (!tex)
+			continue; // failed to load
+		if (tex->palette) {
+			// the cache stores RGBA, which must not share GPU textures with the indexed original
+			const std::uint8_t expanded = 1;
+			::write(os, tex->contentHash != 0 ? fnv1a64({&expanded, 1}, tex->contentHash) : std::uint64_t{0});
+			for (const auto& img : Wad::ExpandPalettized(*tex))
+				writeImage(os, img);
+			continue;
+		}
+		::write(os, tex->contentHash);
+		for (auto level = 0u; level < bsp30::MIPLEVELS; level++)
+			writeImage(os, tex->level(level));
+	}
+
+	writeArray(os, std::span<const Decal>{bsp.m_decals});
+
+	::write(os, static_cast<std::uint32_t>(bsp.visCache.leafCount()));
+	for (auto leaf = 1; leaf <= static_cast<int>(bsp.visCache.leafCount()); leaf++) {
+		const auto row = bsp.visCache.decompress(leaf);
+		writeArray(os, row ? row->bytes() : std::span<const std::uint8_t>{});
+	}
+
+	writeArray(os, std::span<const BspRenderable::VertexWithLM>{geometry.vertices});
+	writeArray(os, std::span<const unsigned int>{geometry.vertexOffsets});
+	writeImage(os, geometry.lightmapAtlas);
+
+	std::clog << "Wrote " << os.tellp() << " bytes\n";
+}
+
+auto BspCache::open(const fs::path& path) -> std::unique_ptr<BspCache> {
+	if (!fileExists(path))
+		return nullptr;
+
+	try {
+		std::unique_ptr<BspCache> cache(new BspCache(openFile(path)));
+		if (!cache->parse())
+			return nullptr;
+		std::clog << "Using runtime cache " << path << "\n";
+		return cache;
+	} catch (const std::exception& e) {
+		std::clog << "Ignoring corrupt runtime cache " << path << ": " << e.what() << "\n";
+		return nullptr;
+	}
+}
+
+BspCache::BspCache(MappedFile file)
+	: m_file(std::move(file)) {}
+
+auto BspCache::parse() -> bool {
+	Cursor c(m_file);
+
+	const auto magic = c.read<std::array<char, 4>>();
+	if (std::memcmp(magic.data(), CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0)
+		throw std::runtime_error("Invalid magic number");
+	if (const auto v = c.read<std::uint32_t>(); v != version) {
+		std::clog << "Ignoring runtime cache of version " << v << " (current is " << version << ")\n";
+		return false;
+	}
+
+	const auto sourceCount = c.read<std::uint32_t>();
+	for (auto i = 0u; i < sourceCount; i++) {
+		const auto name = c.array<char>();
+		const auto source = fs::path(std::string(name.begin(), name.end()));
+		const FileStamp recorded{c.read<std::uint64_t>(), c.read<std::int64_t>()};
+		const auto hash = c.read<std::uint64_t>();
+		const auto stamp = fileStamp(source);
+		if (stamp == recorded)
+			continue; // unchanged without reading the file
+		if (!stamp || hashFile(source) != hash) {
+			std::clog << "Runtime cache is outdated, " << source << " changed\n";
+			return false;
+		}
+	}
+
+	const auto readImage = [&] {
+		const auto width = c.read<std::uint32_t>();
+		const auto height = c.read<std::uint32_t>();
+		const auto channels = c.read<std::uint32_t>();
+		const auto data = c.array<std::uint8_t>();
+		if (data.size() != std::size_t{width} * height * channels)
+			throw std::runtime_error("Image size mismatch in cache");
+		return ImageView{data.data(), width, height, channels};
+	};
+
+	const auto textureCount = c.read<std::uint32_t>();
+	for (auto i = 0u; i < textureCount; i++) {
+		auto& tex = m_textures.emplace_back();
+		if (c.read<std::uint32_t>() == 0)
+			continue; // failed to load
+		tex.emplace();
+		tex->contentHash = c.read<std::uint64_t>();
+		for (auto& level : tex->levels)
+			level = readImage();
+	}
+
+	m_decals = c.array<Decal>();
+
+	const auto visCount = c.read<std::uint32_t>();
+	for (auto i = 0u; i < visCount; i++)
+		m_visRows.push_back(c.array<std::uint8_t>());
+
+	m_vertices = c.array<BspRenderable::VertexWithLM>();
+	m_vertexOffsets = c.array<std::uint32_t>();
+	m_lightmapAtlas = readImage();
+	return true;
+}
+
+auto BspCache::textures() const -> std::vector<std::shared_ptr<const MipmapTexture>> {
+	// the textures may outlive the cache, e.g. in the TextureStore, so they share the mapping
+	std::vector<std::shared_ptr<const MipmapTexture>> textures;
+	for (const auto& cached : m_textures) {
+		if (!cached) {
+			textures.emplace_back();
+			continue;
+		}
+		auto tex = std::make_shared<MipmapTexture>();
+		std::copy(std::begin(cached->levels), std::end(cached->levels), std::begin(tex->mapped));
+		tex->storage = m_file.storage();
+		tex->contentHash = cached->contentHash;
+		textures.push_back(std::move(tex));
+	}
+	return textures;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "BspRenderable.h"
+#include "IO.h"
+
+class Bsp;
+struct Decal;
+struct MipmapTexture;
+
+/// @brief Precompiled runtime data of a map (.hlbspc file)
+/// Holds everything the loader would otherwise derive from the BSP and WAD files at every startup: the expanded textures, the decals,
+/// the decompressed PVS, the triangle list of all faces and the packed lightmap atlas. The cache records the size, write time and content
+/// hash of every file it was built from and is only used if all of them are unchanged. Files are only hashed if their size or write time changed.
+class BspCache {
+public:
+	static constexpr std::uint32_t version = 5;
+
+	static auto pathFor(const fs::path& bspPath) -> fs::path; // maps/foo.bsp -> maps/foo.hlbspc
+
+	// Compiles the cache file for a fully loaded Bsp
+	static void write(const fs::path& path, const Bsp& bsp, const BspRenderable::StaticGeometry& geometry);
+
+	// Maps the cache file if it exists, has the current version and was built from unchanged source files, otherwise returns nullptr
+	static auto open(const fs::path& path) -> std::unique_ptr<BspCache>;
+
+	auto textures() const -> std::vector<std::shared_ptr<const MipmapTexture>>; // null if a texture failed to load, like Bsp::m_textures
+	auto decals() const -> std::span<const Decal> { return m_decals; }
+	auto visRows() const -> const std::vector<std::span<const std::uint8_t>>& { return m_visRows; } // decompressed PVS rows, empty if a leaf has none
+	auto vertices() const -> std::span<const BspRenderable::VertexWithLM> { return m_vertices; }
+	auto vertexOffsets() const -> std::span<const std::uint32_t> { return m_vertexOffsets; }
+	auto lightmapAtlas() const -> ImageView { return m_lightmapAtlas; } // views the mapped file
+
+private:
+	explicit BspCache(MappedFile file);
+	auto parse() -> bool;
+
+	MappedFile m_file;
+	struct CachedTexture {
+		ImageView levels[bsp30::MIPLEVELS];
+		std::uint64_t contentHash;
+	};
+	std::vector<std::optional<CachedTexture>> m_textures; // empty if the texture failed to load
+	std::span<const Decal> m_decals;
+	std::vector<std::span<const std::uint8_t>> m_visRows;
+	std::span<const BspRenderable::VertexWithLM> m_vertices;
+	std::span<const std::uint32_t> m_vertexOffsets;
+	ImageView m_lightmapAtlas;
+};
@@ -1,11 +1,20 @@
 #include "BspRenderable.h"
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
 #include <iostream>
 #include <numeric>
 #include <random>
 
+#include "BlockCompression.h"
 #include "Bsp.h"
+#include "BspCache.h"
 #include "Camera.h"
+#include "Hash.h"
+#include "Mipmap.h"
+#include "ThreadPool.h"
+#include "Wad.h"
 #include "mathlib.h"
 #include "global.h"
 
@@ -15,25 +24,25 @@ namespace {
 		TextureAtlas(unsigned int width, unsigned int height, unsigned int channels = 3)
 			: m_img(width, height, channels), allocated(width) {}
 
-		auto store(const Image& image) -> glm::uvec2 {
-			if (image.channels != m_img.channels)
+		// stores texels with the atlas' channel count
+		auto store(ImageView img) -> glm::uvec2 {
+			if (img.channels != m_img.channels)
 				throw std::logic_error("image and atlas channel count mismatch");
 
-			const auto loc = allocLightmap(image.width, image.height);
+			const auto loc = allocLightmap(img.width, img.height);
 			if (!loc)
 				throw std::runtime_error("atlas is full");
 
-			for (auto y = 0u; y < image.height; y++) {
-				const auto src = &image.data[(y * image.width) * image.channels];
-				const auto dst = &m_img.data[((loc->y + y) * m_img.width + loc->x) * image.channels];
-				std::copy(src, src + image.width * image.channels, dst);
+			for (auto y = 0u; y < img.height; y++) {
+				const auto src = img.row(y);
+				std::copy(src.begin(), src.end(), m_img(loc->x, loc->y + y));
 			}
 
 			return *loc;
 		}
 
-		auto convertCoord(const Image& image, glm::uvec2 storedPos, glm::vec2 coord) {
-			return (glm::vec2(storedPos) + coord * glm::vec2(image.width, image.height)) / glm::vec2(m_img.width, m_img.height);
+		auto convertCoord(glm::uvec2 size, glm::uvec2 storedPos, glm::vec2 coord) {
+			return (glm::vec2(storedPos) + coord * glm::vec2(size)) / glm::vec2(m_img.width, m_img.height);
 		}
 
 		auto img() const -> const auto& { return m_img; }
@@ -72,14 +81,154 @@ namespace {
 		std::vector<unsigned int> allocated;
 		Image m_img;
 	};
+
+	auto textureHash(const MipmapTexture& mipTex) -> std::uint64_t {
+		// textures from the TextureStore carry the hash of their source data, others are hashed by content
+		const auto img = mipTex.level(0);
+		const std::uint32_t size[] = {img.width, img.height, img.channels};
+		return mipTex.contentHash != 0 ? mipTex.contentHash : fnv1a64(img.bytes(), fnv1a64({reinterpret_cast<const std::uint8_t*>(size), sizeof(size)}));
+	}
+
+	// All decal textures of a map with their full mip chains. A texture whose chain ends at level n gets a square cell of 2^(n+1) texels,
+	// and cells start at multiples of their size, so each level of a texture lies on whole atlas texels followed by transparent ones
+	// and filtering does not bleed. Below its last level a texture is left out of the atlas.
+	struct DecalAtlas {
+		std::vector<Image> levels;
+		std::unordered_map<std::uint32_t, std::pair<glm::vec2, glm::vec2>> placement; // texture index to offset and size in texture coordinates
+	};
+
+	auto buildDecalAtlas(const Bsp& bsp) -> DecalAtlas {
+		std::vector<std::uint32_t> texIndices;
+		for (const auto& decal : bsp.m_decals)
+			texIndices.push_back(decal.texIndex);
+		std::sort(begin(texIndices), end(texIndices));
+		texIndices.erase(std::unique(begin(texIndices), end(texIndices)), end(texIndices));
+		if (texIndices.empty())
+			return {};
+
+		// shelves of the largest cells first, so every cell starts at a multiple of its size. Widened until the atlas is about square.
+		const auto& textures = bsp.m_textures;
+		const auto cellOf = [&](std::uint32_t i) {
+			const auto img = textures[i]->level(0);
+			return 2 * std::bit_floor(std::max({img.width, img.height, 1u << (bsp30::MIPLEVELS - 1)})); // the stored levels always fit
+		};
+		std::stable_sort(begin(texIndices), end(texIndices), [&](std::uint32_t a, std::uint32_t b) { return cellOf(a) > cellOf(b); });
+		unsigned int width = std::max(64u, cellOf(texIndices.front()));
+		std::vector<glm::uvec2> positions(texIndices.size());
+		unsigned int height = 0;
+		while (true) {
+			glm::uvec2 cursor{0, 0};
+			unsigned int shelfHeight = 0;
+			for (auto j = 0u; j < texIndices.size(); j++) {
+				const auto cell = cellOf(texIndices[j]);
+				if (cursor.x + cell > width) {
+					cursor = {0, cursor.y + shelfHeight};
+					shelfHeight = 0;
+				}
+				positions[j] = cursor;
+				cursor.x += cell;
+				shelfHeight = std::max(shelfHeight, cell);
+			}
+			height = cursor.y + shelfHeight;
+			if (height <= width)
+				break;
+			width *= 2;
+		}
+
+		DecalAtlas atlas;
+		const auto levelCount = static_cast<unsigned int>(std::bit_width(cellOf(texIndices.front()))) - 1; // down to the last level of the largest texture
+		for (auto level = 0u; level < levelCount; level++)
+			atlas.levels.emplace_back(std::max(width >> level, 1u), std::max(height >> level, 1u), 4); // transparent black
+		for (auto j = 0u; j < texIndices.size(); j++) {
+			const auto& mipTex = *textures[texIndices[j]];
+			const auto expanded = mipTex.palette ? Wad::ExpandPalettized(mipTex) : std::vector<Image>{};
+			std::vector<ImageView> levels;
+			for (auto level = 0u; level < bsp30::MIPLEVELS; level++)
+				levels.push_back(mipTex.palette ? ImageView{expanded[level]} : mipTex.level(level));
+			const auto generated = missingMipLevels(levels);
+			levels.insert(levels.end(), generated.begin(), generated.end());
+
+			for (auto level = 0u; level < levels.size(); level++) {
+				const auto& src = levels[level];
+				auto& dst = atlas.levels[level];
+				for (auto y = 0u; y < src.height; y++) {
+					const auto row = src.row(y);
+					std::copy(row.begin(), row.end(), dst(positions[j].x >> level, (positions[j].y >> level) + y));
+				}
+			}
+			const auto atlasSize = glm::vec2(width, height);
+			atlas.placement[texIndices[j]] = {glm::vec2(positions[j]) / atlasSize, glm::vec2(levels[0].width, levels[0].height) / atlasSize};
+		}
+		return atlas;
+	}
+
 }
 
-BspRenderable::BspRenderable(render::IRenderer& renderer, const Bsp& bsp, const Camera& camera)
-	: m_renderer(renderer), m_bsp(&bsp), m_camera(&camera) {
+// Views of RGBA levels. Stored levels are viewed in place, expanded and generated levels are owned.
+struct BspRenderable::MipChain {
+	std::shared_ptr<const MipmapTexture> source; // of the viewed stored levels
+	std::vector<Image> owned;
+	std::vector<ImageView> levels;
+	std::vector<CompressedImage> compressed; // of levels, if requested
+
+	void append(std::vector<Image> images) {
+		for (auto& img : images)
+			levels.push_back(owned.emplace_back(std::move(img))); // moving an Image keeps its pixels in place
+	}
+};
+
+// Levels of a texture prepared on the pool, polled by the render thread
+struct BspRenderable::ChainJob {
+	std::shared_ptr<const MipChain> chain; // null if preparing failed
+	std::atomic<bool> done = false;
+};
+
+auto BspRenderable::fullMipChain(std::shared_ptr<const MipmapTexture> mipTex, bool compress, std::optional<BlockFormat> format) -> std::shared_ptr<const MipChain> {
+	// the miptextures only store the first 4 levels
+	auto chain = std::make_shared<MipChain>();
+	if (mipTex->palette)
+		chain->append(Wad::ExpandPalettized(*mipTex));
+	else
+		for (auto i = 0u; i < bsp30::MIPLEVELS; i++)
+			chain->levels.push_back(mipTex->level(i));
+	chain->append(missingMipLevels(chain->levels));
+	if (compress)
+		chain->compressed = compressMipmaps(chain->levels, textureHash(*mipTex), format);
+	chain->source = std::move(mipTex);
+	return chain;
+}
+
+auto BspRenderable::lowResMipChain(std::shared_ptr<const MipmapTexture> mipTex) -> std::shared_ptr<const MipChain> {
+	auto chain = std::make_shared<MipChain>();
+	if (mipTex->palette) {
+		auto levels = Wad::ExpandPalettized(*mipTex);
+		chain->append({std::move(levels.back())});
+	} else
+		chain->levels.push_back(mipTex->level(bsp30::MIPLEVELS - 1));
+	chain->append(missingMipLevels(chain->levels));
+	chain->source = std::move(mipTex);
+	return chain;
+}
+
+BspRenderable::BspRenderable(render::IRenderer& renderer, const Bsp& bsp, const Camera& camera, TextureCache& textureCache, std::optional<StaticGeometry> geometry)
+	: m_renderer(renderer), m_bsp(&bsp), m_camera(&camera), m_textureCache(textureCache) {
+	if (bsp.profile() != LoadProfile::Full)
+		throw std::logic_error("Rendering a map requires the full load profile");
 	loadSkyTextures();
 	loadTextures();
-	auto lmCoords = loadLightmaps();
-	buildBuffers(std::move(lmCoords));
+	if (geometry) {
+		vertexOffsets = std::move(geometry->vertexOffsets);
+		uploadStaticGeometry(geometry->vertices, geometry->lightmapAtlas);
+	} else if (bsp.m_cache) {
+		const auto offsets = bsp.m_cache->vertexOffsets();
+		vertexOffsets.assign(offsets.begin(), offsets.end());
+		uploadStaticGeometry(bsp.m_cache->vertices(), bsp.m_cache->lightmapAtlas());
+	} else {
+		auto geometry = buildStaticGeometry(bsp);
+		vertexOffsets = std::move(geometry.vertexOffsets);
+		uploadStaticGeometry(geometry.vertices, geometry.lightmapAtlas);
+	}
+	buildDecalBuffer();
 
 	facesDrawn.resize(bsp.faces.size());
 }
@@ -100,53 +249,343 @@ void BspRenderable::loadTextures() {
 	//}
 	//atlas.img().Save("tex_atlas.png");
 
-	m_textures.reserve(mipTexs.size());
-	for (const auto& mipTex : mipTexs)
-		m_textures.emplace_back(m_renderer.createTexture(std::vector<Image>{mipTex.Img, mipTex.Img + 4}));
+	std::erase_if(m_textureCache, [](const auto& entry) { return entry.second.expired(); });
+
+	Image grey(1, 1, 4);
+	std::fill(grey.data.begin(), grey.data.end(), std::uint8_t{160});
+	m_placeholder = m_renderer.createTexture({grey});
+
+	if (global::textureBudget > 0) {
+		// arrays cannot release single layers, so managed world textures are separate textures
+		m_residency.emplace(global::textureBudget);
+		const auto compressed = global::compressTextures && m_renderer.supportsBlockCompression();
+		for (auto i = 0u; i < m_bsp->mipTextures.size(); i++) {
+			const auto& mt = m_bsp->mipTextures[i];
+			const auto texelBytes = compressed || global::palettizedTextures ? 1 : 4; // BC3 or indices
+			m_residency->add(i, std::size_t{mt.width} * mt.height * texelBytes * 4 / 3);
+		}
+	} else
+		createTextureArrays();
+
+	// expand, complete and compress the mip chains in parallel, only the uploads have to stay on this thread
+	std::vector<std::function<std::shared_ptr<const MipChain>()>> jobs(mipTexs.size());
+	for (auto i = 0u; i < mipTexs.size() && i < m_bsp->mipTextures.size(); i++)
+		if (m_bsp->textureReady(i))
+			jobs[i] = mipChainJob(i);
+	std::vector<std::shared_ptr<const MipChain>> chains(mipTexs.size());
+	ThreadPool::shared().parallelFor(jobs.size(), [&](std::size_t i) {
+		if (jobs[i])
+			chains[i] = jobs[i]();
+	});
+
+	m_textures.resize(mipTexs.size()); // null for textures in arrays
+	for (auto i = 0u; i < mipTexs.size(); i++) {
+		if (i >= m_bsp->mipTextures.size())
+			break; // decal textures are drawn from the decal atlas
+		const auto arrayed = isArrayed(i);
+		if (!m_bsp->textureReady(i)) {
+			// grey until the texture is decoded
+			if (arrayed)
+				uploadArrayLayerPlaceholder(i);
+			else
+				m_textures[i] = m_placeholder;
+			m_pendingTextures.push_back(i);
+		} else if (arrayed) {
+			if (mipTexs[i])
+				uploadArrayLayer(i, *mipTexs[i], std::move(chains[i]));
+			else
+				uploadArrayLayerPlaceholder(i); // failed to load
+		} else if (mipTexs[i])
+			setTexture(i, uploadWorldTexture(i, std::move(chains[i])));
+		else
+			m_textures[i] = m_placeholder; // failed to load
+	}
 }
 
-auto BspRenderable::loadLightmaps() -> std::vector<std::vector<glm::vec2>> {
-	const auto& lightmaps = m_bsp->m_lightmaps;
+void BspRenderable::setTexture(std::size_t texIndex, std::shared_ptr<render::ITexture> tex) {
+	std::erase_if(m_uploadingTextures, [&](const auto& u) { return u.first == texIndex; }); // superseded
+	if (m_renderer.textureReady(*tex)) {
+		m_textures[texIndex] = std::move(tex);
+		return;
+	}
+	if (!m_textures[texIndex])
+		m_textures[texIndex] = m_placeholder;
+	m_uploadingTextures.emplace_back(texIndex, std::move(tex));
+}
 
-	// create lightmap atlas
-	TextureAtlas atlas(1024, 1024, 3);
-	std::vector<glm::uvec2> lmPositions(lightmaps.size());
-	for (auto i = 0u; i < lightmaps.size(); i++) {
-		const auto& lm = lightmaps[i];
-		if (lm.width == 0 || lm.height == 0)
-			continue;
-		lmPositions[i] = atlas.store(lm);
+void BspRenderable::swapInUploadedTextures() {
+	std::erase_if(m_uploadingTextures, [&](auto& u) {
+		if (!m_renderer.textureReady(*u.second))
+			return false;
+		m_textures[u.first] = std::move(u.second);
+		return true;
+	});
+}
+
+void BspRenderable::swapInReadyTextures() {
+	const auto& mipTexs = m_bsp->m_textures;
+	std::erase_if(m_pendingTextures, [&](std::size_t i) {
+		if (!m_bsp->textureReady(i))
+			return false;
+		if (!mipTexs[i])
+			return true; // failed to load, keep the placeholder
+
+		std::shared_ptr<const MipChain> chain;
+		if (m_chainJobs.contains(i)) {
+			auto prepared = takePreparedChain(i);
+			if (!prepared)
+				return false;
+			if (!*prepared)
+				return true; // keep the placeholder
+			chain = std::move(*prepared);
+		} else if (auto job = mipChainJob(i)) {
+			startChainJob(i, std::move(job));
+			return false;
+		}
+
+		if (m_textures[i])
+			setTexture(i, uploadWorldTexture(i, std::move(chain)));
+		else
+			uploadArrayLayer(i, *mipTexs[i], std::move(chain), true);
+		return true;
+	});
+}
+
+void BspRenderable::startChainJob(std::size_t texIndex, std::function<std::shared_ptr<const MipChain>()> job) {
+	// expand and compress on the pool, so this thread only submits the uploads once the levels are prepared
+	auto state = std::make_shared<ChainJob>();
+	ThreadPool::shared().submit([state, job = std::move(job)] {
+		try {
+			state->chain = job();
+		} catch (const std::exception& e) {
+			std::clog << "Failed to prepare texture levels: " << e.what() << "\n";
+		}
+		state->done.store(true, std::memory_order_release);
+	});
+	m_chainJobs.insert_or_assign(texIndex, std::move(state));
+}
+
+auto BspRenderable::takePreparedChain(std::size_t texIndex) -> std::optional<std::shared_ptr<const MipChain>> {
+	const auto it = m_chainJobs.find(texIndex);
+	if (it == m_chainJobs.end() || !it->second->done.load(std::memory_order_acquire))
+		return {};
+	auto chain = std::move(it->second->chain);
+	m_chainJobs.erase(it);
+	return chain;
+}
+
+auto BspRenderable::mipChainJob(std::size_t texIndex) const -> std::function<std::shared_ptr<const MipChain>()> {
+	auto mipTex = m_bsp->m_textures[texIndex];
+	if (!mipTex || (m_residency && !m_residency->resident(texIndex)))
+		return {}; // uploaded at low resolution first
+	if (isArrayed(texIndex)) {
+		if (m_arrayFormat == render::TextureArrayFormat::Indexed)
+			return {}; // the stored indices, or a placeholder for expanded textures
+		return [mipTex, compress = m_arrayFormat == render::TextureArrayFormat::BC3] { return fullMipChain(mipTex, compress, BlockFormat::BC3); };
+	}
+	if (mipTex->palette || m_textureCache.contains(textureHash(*mipTex)))
+		return {}; // uploaded as indices or reused
+	return [mipTex, compress = global::compressTextures && m_renderer.supportsBlockCompression()] { return fullMipChain(mipTex, compress); };
+}
+
+auto BspRenderable::isArrayed(std::size_t texIndex) const -> bool {
+	return !m_textureArrays.empty() && texIndex < m_arrayLayout.bucketOf.size() && m_arrayLayout.bucketOf[texIndex] >= 0;
+}
+
+auto BspRenderable::uploadWorldTexture(std::size_t texIndex, std::shared_ptr<const MipChain> chain) -> std::shared_ptr<render::ITexture> {
+	const auto& mipTex = m_bsp->m_textures[texIndex];
+	if (m_residency && texIndex < m_bsp->mipTextures.size() && !m_residency->resident(texIndex))
+		return uploadLowResTexture(mipTex);
+	return uploadTexture(mipTex, std::move(chain));
+}
+
+void BspRenderable::updateResidency() {
+	const auto& mipTexs = m_bsp->m_textures;
+	const auto plan = m_residency->update([&](std::size_t i) {
+		return m_bsp->textureReady(i) && mipTexs[i] && std::find(begin(m_pendingTextures), end(m_pendingTextures), i) == end(m_pendingTextures);
+	});
+	for (const auto i : plan.evict) {
+		if (std::erase(m_promotingTextures, i) > 0)
+			m_chainJobs.erase(i); // the prepared chain is dropped
+		setTexture(i, uploadLowResTexture(mipTexs[i]));
 	}
-	atlas.img().Save("lm_atlas.png");
-
-	// recompute lightmap coords
-	std::vector<std::vector<glm::vec2>> lmCoords(m_bsp->faces.size());
-	for (const auto& face : m_bsp->faces) {
-		const auto faceIndex = &face - &m_bsp->faces.front();
-		auto& coords = m_bsp->faceTexCoords[faceIndex];
-		for (auto& coord : coords.lightmapCoords)
-			lmCoords[faceIndex].push_back(atlas.convertCoord(lightmaps[faceIndex], lmPositions[faceIndex], coord));
+	for (const auto i : plan.load) {
+		// the low resolution levels stay until the full chain is prepared on the pool and uploaded
+		if (auto job = mipChainJob(i)) {
+			startChainJob(i, std::move(job));
+			m_promotingTextures.push_back(i);
+		} else
+			setTexture(i, uploadTexture(mipTexs[i]));
 	}
 
-	m_lightmapAtlas = m_renderer.createTexture({ atlas.img() });
-	return lmCoords;
+	std::erase_if(m_promotingTextures, [&](std::size_t i) {
+		auto chain = takePreparedChain(i);
+		if (!chain)
+			return false;
+		if (*chain)
+			setTexture(i, uploadTexture(mipTexs[i], std::move(*chain)));
+		return true; // stays at low resolution if preparing failed
+	});
+}
+
+auto BspRenderable::textureArrayLayout(const Bsp& bsp) -> TextureArrayLayout {
+	TextureArrayLayout layout;
+	std::unordered_map<std::uint64_t, int> openBucket; // by size, the bucket which still has free layers
+	for (const auto& mipTex : bsp.mipTextures) {
+		auto& bucket = layout.bucketOf.emplace_back(-1);
+		auto& layer = layout.layerOf.emplace_back(0);
+		if (mipTex.width == 0 || mipTex.height == 0 || mipTex.width % 16 != 0 || mipTex.height % 16 != 0)
+			continue; // cannot share storage with well formed mip chains
+
+		auto& b = openBucket.try_emplace(std::uint64_t{mipTex.width} << 32 | mipTex.height, -1).first->second;
+		if (b < 0 || layout.buckets[b].layers == TextureArrayLayout::maxLayers) {
+			b = static_cast<int>(layout.buckets.size());
+			layout.buckets.push_back({mipTex.width, mipTex.height});
+		}
+		bucket = b;
+		layer = layout.buckets[b].layers++;
+	}
+	return layout;
+}
+
+void BspRenderable::createTextureArrays() {
+	if (!m_renderer.supportsTextureArrays())
+		return;
+
+	m_arrayLayout = textureArrayLayout(*m_bsp);
+	if (global::palettizedTextures && !m_bsp->runtimeCache())
+		m_arrayFormat = render::TextureArrayFormat::Indexed; // the cache holds expanded textures
+	else if (global::compressTextures && m_renderer.supportsBlockCompression())
+		m_arrayFormat = render::TextureArrayFormat::BC3; // a single format per array, so textures with alpha fit too
+	else
+		m_arrayFormat = render::TextureArrayFormat::RGBA8;
+
+	for (const auto& b : m_arrayLayout.buckets)
+		m_textureArrays.push_back(m_renderer.createTextureArray(m_arrayFormat, b.width, b.height, b.layers));
+}
+
+void BspRenderable::uploadArrayLayer(std::size_t texIndex, const MipmapTexture& mipTex, std::shared_ptr<const MipChain> chain, bool async) {
+	const auto& bucket = m_arrayLayout.buckets[m_arrayLayout.bucketOf[texIndex]];
+	const auto img0 = mipTex.level(0);
+	if (img0.width != bucket.width || img0.height != bucket.height) {
+		std::clog << "Texture " << m_bsp->mipTextures[texIndex].name << " from a WAD file has a different size than in the BSP (" << img0.width << "x" << img0.height << ")\n";
+		uploadArrayLayerPlaceholder(texIndex);
+		return;
+	}
+
+	auto& array = *m_textureArrays[m_arrayLayout.bucketOf[texIndex]];
+	const auto layer = m_arrayLayout.layerOf[texIndex];
+	if (m_arrayFormat == render::TextureArrayFormat::Indexed) {
+		if (mipTex.palette)
+			m_renderer.setTextureArrayLayer(array, layer, std::vector<ImageView>(mipTex.Img, mipTex.Img + bsp30::MIPLEVELS), &*mipTex.palette); // 4 small levels
+		else
+			uploadArrayLayerPlaceholder(texIndex); // an expanded texture, e.g. from the runtime cache, is not expected, but keep the layer defined
+		return;
+	}
+
+	const auto compressed = m_arrayFormat == render::TextureArrayFormat::BC3;
+	if (!chain)
+		chain = fullMipChain(m_bsp->m_textures[texIndex], compressed, BlockFormat::BC3);
+	if (compressed && async)
+		m_renderer.setTextureArrayLayerAsync(array, layer, std::shared_ptr<const std::vector<CompressedImage>>(chain, &chain->compressed)); // owned by the chain
+	else if (compressed)
+		m_renderer.setTextureArrayLayer(array, layer, chain->compressed);
+	else if (async)
+		m_renderer.setTextureArrayLayerAsync(array, layer, chain->levels, chain); // the chain keeps the viewed levels alive
+	else
+		m_renderer.setTextureArrayLayer(array, layer, chain->levels, nullptr);
+}
+
+void BspRenderable::uploadArrayLayerPlaceholder(std::size_t texIndex) {
+	const auto& bucket = m_arrayLayout.buckets[m_arrayLayout.bucketOf[texIndex]];
+	auto& array = *m_textureArrays[m_arrayLayout.bucketOf[texIndex]];
+	const auto layer = m_arrayLayout.layerOf[texIndex];
+
+	const auto indexed = m_arrayFormat == render::TextureArrayFormat::Indexed;
+	const auto levelCount = indexed ? bsp30::MIPLEVELS : mipLevelCount(bucket.width, bucket.height);
+	std::vector<Image> images;
+	for (auto i = 0u; i < levelCount; i++) {
+		auto& img = images.emplace_back(std::max(bucket.width >> i, 1u), std::max(bucket.height >> i, 1u), indexed ? 1 : 4);
+		std::fill(img.data.begin(), img.data.end(), static_cast<std::uint8_t>(indexed ? 0 : 160));
+	}
+	const std::vector<ImageView> levels(begin(images), end(images));
+
+	if (m_arrayFormat == render::TextureArrayFormat::BC3) {
+		const std::uint32_t key[] = {bucket.width, bucket.height, 160};
+		m_renderer.setTextureArrayLayer(array, layer, compressMipmaps(levels, fnv1a64({reinterpret_cast<const std::uint8_t*>(key), sizeof(key)}), BlockFormat::BC3));
+	} else if (indexed) {
+		PaletteLut grey;
+		grey.fill(0xFFA0A0A0); // 160, 160, 160, 255
+		m_renderer.setTextureArrayLayer(array, layer, levels, &grey);
+	} else
+		m_renderer.setTextureArrayLayer(array, layer, levels, nullptr);
+}
+
+auto BspRenderable::uploadTexture(const std::shared_ptr<const MipmapTexture>& mipTex, std::shared_ptr<const MipChain> chain) -> std::shared_ptr<render::ITexture> {
+	if (const auto img0 = mipTex->level(0); img0.width == 0 || img0.height == 0)
+		return m_placeholder; // nothing to upload
+	const auto hash = textureHash(*mipTex);
+	auto& cached = m_textureCache[hash];
+	if (auto tex = cached.lock())
+		return tex;
+
+	std::shared_ptr<render::ITexture> tex = [&]() -> std::unique_ptr<render::ITexture> {
+		if (mipTex->palette)
+			return m_renderer.createPalettizedTexture(*mipTex); // indices cannot be filtered, so these keep their 4 levels
+		const auto compress = global::compressTextures && m_renderer.supportsBlockCompression();
+		if (!chain)
+			chain = fullMipChain(mipTex, compress);
+		if (compress)
+			return m_renderer.createCompressedTexture(chain->compressed);
+		return m_renderer.createTextureAsync(chain->levels, chain); // the chain keeps the viewed levels alive
+	}();
+	cached = tex;
+	return tex;
+}
+
+auto BspRenderable::uploadLowResTexture(const std::shared_ptr<const MipmapTexture>& mipTex) -> std::shared_ptr<render::ITexture> {
+	if (const auto img0 = mipTex->level(0); img0.width == 0 || img0.height == 0)
+		return m_placeholder;
+	const std::uint8_t lowRes = 1;
+	const auto hash = fnv1a64({&lowRes, 1}, textureHash(*mipTex));
+	auto& cached = m_textureCache[hash];
+	if (auto tex = cached.lock())
+		return tex;
+
+	const auto chain = lowResMipChain(mipTex);
+	std::shared_ptr<render::ITexture> tex = global::compressTextures && m_renderer.supportsBlockCompression()
+		? m_renderer.createCompressedTexture(compressMipmaps(chain->levels, hash))
+		: m_renderer.createTexture(chain->levels);
+	cached = tex;
+	return tex;
 }
 
 void BspRenderable::loadSkyTextures() {
 	const auto images = m_bsp->loadSkyBox();
 	if (!images)
 		return;
-	m_skyboxTex = m_renderer.createCubeTexture(*images);
+	std::array<ImageView, 6> sides;
+	std::copy(begin(*images), end(*images), begin(sides));
+	m_skyboxTex = m_renderer.createCubeTexture(sides);
 }
 
 void BspRenderable::render(const RenderSettings& settings) {
 	m_settings = &settings;
 
+	if (!m_pendingTextures.empty())
+		swapInReadyTextures();
+	if (m_residency)
+		updateResidency(); // before the faces reference the textures of this frame
+	if (!m_uploadingTextures.empty())
+		swapInUploadedTextures();
+
 	// render sky box
 	if (m_skyboxTex && global::renderSkybox)
 		renderSkybox();
 
 	const auto& cameraPos = m_camera->position();
+	const auto leaf = m_bsp->findLeaf(cameraPos);
+	const auto visList = leaf ? m_bsp->visCache.row(*leaf) : nullptr; // keeps the row alive even if it is evicted meanwhile
 
 	if (global::renderStaticBSP || global::renderBrushEntities)
 		for (auto&& b : facesDrawn)
@@ -154,35 +593,25 @@ void BspRenderable::render(const RenderSettings& settings) {
 
 	std::vector<render::EntityData> ents;
 	if (global::renderStaticBSP)
-		ents.push_back(render::EntityData{ renderStaticGeometry(cameraPos), glm::vec3{}, 1.0f, bsp30::RenderMode::RENDER_MODE_NORMAL });
+		ents.push_back(render::EntityData{ renderStaticGeometry(cameraPos, visList.get()), glm::vec3{}, 1.0f, bsp30::RenderMode::RENDER_MODE_NORMAL });
 
 	if (global::renderBrushEntities) {
+		const auto& table = m_bsp->entityTable;
 		for (const auto i : m_bsp->brushEntities) {
-			const auto& ent = m_bsp->entities[i];
-
-			const int model = std::stoi(ent.findProperty("model")->substr(1));
-
-			const auto alpha = [&] {
-				if (const auto renderamt = ent.findProperty("renderamt"))
-					return std::stoi(*renderamt) / 255.0f;
-				return 1.0f;
-			}();
-
-			const auto renderMode = [&] {
-				if (const auto pszRenderMode = ent.findProperty("rendermode"))
-					return static_cast<bsp30::RenderMode>(std::stoi(*pszRenderMode));
-				else
-					return bsp30::RENDER_MODE_NORMAL;
-			}();
+			const auto& model = m_bsp->models[table.model[i]];
 
 			std::vector<render::FaceRenderInfo> fri;
-			renderBSP(m_bsp->models[model].headNodesIndex[0], boost::dynamic_bitset<uint8_t>{}, cameraPos, fri); // for some odd reason, VIS does not work for entities ...
+			renderBSP(model.headNodesIndex[0], nullptr, cameraPos, fri); // for some odd reason, VIS does not work for entities ...
 
-			ents.push_back(render::EntityData{ std::move(fri), m_bsp->models[model].origin, alpha, renderMode });
+			ents.push_back(render::EntityData{ std::move(fri), model.origin, table.renderAmount[i], table.renderMode[i] });
 		}
 	}
 
-	m_renderer.renderStatic(std::move(ents), m_bsp->m_decals, *m_staticGeometryVao, *m_decalVao, m_textures, *m_lightmapAtlas, settings);
+	std::vector<render::FaceRenderInfo> decals;
+	if (global::renderDecals)
+		decals = visibleDecals(visList.get());
+
+	m_renderer.renderStatic(std::move(ents), std::move(decals), *m_staticGeometryVao, *m_decalVao, *m_lightmapAtlas, settings);
 
 	// Leaf outlines
 	if (global::renderLeafOutlines) {
@@ -200,13 +629,29 @@ void BspRenderable::renderSkybox() {
 	m_renderer.renderSkyBox(**m_skyboxTex, matrix);
 }
 
-auto BspRenderable::renderStaticGeometry(glm::vec3 pos) -> std::vector<render::FaceRenderInfo> {
+auto BspRenderable::renderStaticGeometry(glm::vec3 pos, const VisRow* visList) -> std::vector<render::FaceRenderInfo> {
 	std::vector<render::FaceRenderInfo> fri;
-	const auto leaf = m_bsp->findLeaf(pos);
-	renderBSP(0, !leaf || m_bsp->visLists.empty() ? boost::dynamic_bitset<std::uint8_t>{} : m_bsp->visLists[*leaf - 1], pos, fri);
+	renderBSP(0, visList, pos, fri);
 	return fri;
 }
 
+auto BspRenderable::visibleDecals(const VisRow* visList) const -> std::vector<render::FaceRenderInfo> {
+	// consecutive visible decals are merged into one range
+	std::vector<render::FaceRenderInfo> ranges;
+	if (!m_decalAtlas)
+		return ranges;
+	for (auto i = 0u; i < m_decalLeaves.size(); i++) {
+		const auto leaf = m_decalLeaves[i];
+		if (visList && leaf > 0 && (static_cast<std::size_t>(leaf - 1) >= visList->size() || !(*visList)[leaf - 1]))
+			continue;
+		if (!ranges.empty() && ranges.back().offset + ranges.back().count == i * 6)
+			ranges.back().count += 6;
+		else
+			ranges.push_back({m_decalAtlas.get(), i * 6, 6});
+	}
+	return ranges;
+}
+
 //void BspRenderable::renderLeafOutlines() {
 //	std::mt19937 engine;
 //	std::uniform_real_distribution dist(0.0f, 1.0f);
@@ -270,9 +715,15 @@ void BspRenderable::renderLeaf(int leaf, std::vector<render::FaceRenderInfo>& fr
 		const bool lightmapAvailable = static_cast<signed>(face.lightmapOffset) != -1 && m_bsp->header.lump[bsp30::LumpType::LUMP_LIGHTING].length > 0;
 
 		auto& fri = fris.emplace_back();
-		if (global::textures)
-			fri.tex = m_textures[m_bsp->textureInfos[face.textureInfo].miptexIndex].get();
-		else
+		if (global::textures) {
+			const auto texIndex = m_bsp->textureInfos[face.textureInfo].miptexIndex;
+			if (m_residency)
+				m_residency->touch(texIndex);
+			if (m_textures[texIndex])
+				fri.tex = m_textures[texIndex].get();
+			else
+				fri.tex = m_textureArrays[m_arrayLayout.bucketOf[texIndex]].get(); // the vertices select the layer
+		} else
 			fri.tex = nullptr;
 
 		fri.offset = vertexOffsets[faceIndex];
@@ -280,13 +731,13 @@ void BspRenderable::renderLeaf(int leaf, std::vector<render::FaceRenderInfo>& fr
 	}
 }
 
-void BspRenderable::renderBSP(int node, const boost::dynamic_bitset<std::uint8_t>& visList, glm::vec3 pos, std::vector<render::FaceRenderInfo>& fri) {
+void BspRenderable::renderBSP(int node, const VisRow* visList, glm::vec3 pos, std::vector<render::FaceRenderInfo>& fri) {
 	if (node < 0) {
 		if (node == -1)
 			return;
 
 		const int leaf = ~node;
-		if (!visList.empty() && !visList[leaf - 1])
+		if (visList && (static_cast<std::size_t>(leaf - 1) >= visList->size() || !(*visList)[leaf - 1]))
 			return;
 
 		renderLeaf(leaf, fri);
@@ -309,70 +760,102 @@ void BspRenderable::renderBSP(int node, const boost::dynamic_bitset<std::uint8_t
 	renderBSP(m_bsp->nodes[node].childIndex[child2], visList, pos, fri);
 }
 
-void BspRenderable::buildBuffers(std::vector<std::vector<glm::vec2>>&& lmCoords) {
-	{
-		// static and brush geometry
-		std::vector<VertexWithLM> vertices;
-
-		for (const auto& face : m_bsp->faces) {
-			const auto faceIndex = &face - &m_bsp->faces.front();
-			const auto& coords = m_bsp->faceTexCoords[faceIndex];
-			const auto firstIndex = vertices.size();
-			for (int i = 0; i < face.edgeCount; i++) {
-				if (i > 2) {
-					auto first = vertices[firstIndex];
-					auto prev = vertices.back();
-					vertices.push_back(first);
-					vertices.push_back(prev);
-				}
-
-				auto& v = vertices.emplace_back();
-				v.texCoord = coords.texCoords[i];
-				v.lightmapCoord = lmCoords[faceIndex].empty() ? glm::vec2{ 0.0 } : lmCoords[faceIndex][i];
+auto BspRenderable::buildStaticGeometry(const Bsp& bsp) -> StaticGeometry {
+	if (bsp.profile() != LoadProfile::Full)
+		throw std::logic_error("Static geometry requires the full load profile");
+	StaticGeometry geometry;
 
-				v.normal = m_bsp->planes[face.planeIndex].normal;
-				if (face.planeSide)
-					v.normal = -v.normal;
+	// create lightmap atlas
+	const auto& lightmaps = bsp.m_lightmaps;
+	TextureAtlas atlas(1024, 1024, 3);
+	std::vector<glm::uvec2> lmPositions(lightmaps.size());
+	for (auto i = 0u; i < lightmaps.size(); i++) {
+		const auto& lm = lightmaps[i];
+		if (lm.width == 0 || lm.height == 0)
+			continue;
+		lmPositions[i] = atlas.store({bsp.lightmapTexels(i).data(), lm.width, lm.height, 3});
+	}
 
-				int edge = m_bsp->surfEdges[face.firstEdgeIndex + i];
-				if (edge > 0)
-					v.position = m_bsp->vertices[m_bsp->edges[edge].vertexIndex[0]];
-				else
-					v.position = m_bsp->vertices[m_bsp->edges[-edge].vertexIndex[1]];
+	const auto arrayLayout = textureArrayLayout(bsp);
+
+	// static and brush geometry
+	auto& vertices = geometry.vertices;
+	for (const auto& face : bsp.faces) {
+		const auto faceIndex = &face - &bsp.faces.front();
+		const auto texCoords = bsp.faceTexCoords.texCoordsOf(faceIndex);
+		const auto lightmapCoords = bsp.faceTexCoords.lightmapCoordsOf(faceIndex);
+		const auto& lm = lightmaps[faceIndex];
+		const auto texLayer = static_cast<float>(arrayLayout.layerOf[bsp.textureInfos[face.textureInfo].miptexIndex]);
+		const auto firstIndex = vertices.size();
+		for (int i = 0; i < face.edgeCount; i++) {
+			if (i > 2) {
+				auto first = vertices[firstIndex];
+				auto prev = vertices.back();
+				vertices.push_back(first);
+				vertices.push_back(prev);
 			}
-			vertexOffsets.push_back(static_cast<unsigned int>(firstIndex));
-		}
 
-		m_staticGeometryVbo = m_renderer.createBuffer(vertices.size() * sizeof(VertexWithLM), vertices.data());
-		m_staticGeometryVao = m_renderer.createInputLayout(*m_staticGeometryVbo, {
-			render::AttributeLayout{ "POSITION", 0, 3, render::AttributeLayout::Type::Float, sizeof(VertexWithLM), offsetof(VertexWithLM, position     ) },
-			render::AttributeLayout{ "NORMAL"  , 0, 3, render::AttributeLayout::Type::Float, sizeof(VertexWithLM), offsetof(VertexWithLM, normal       ) },
-			render::AttributeLayout{ "TEXCOORD", 0, 2, render::AttributeLayout::Type::Float, sizeof(VertexWithLM), offsetof(VertexWithLM, texCoord     ) },
-			render::AttributeLayout{ "TEXCOORD", 1, 2, render::AttributeLayout::Type::Float, sizeof(VertexWithLM), offsetof(VertexWithLM, lightmapCoord) }
-		});
+			auto& v = vertices.emplace_back();
+			v.texCoord = texCoords[i];
+			v.texLayer = texLayer;
+			v.lightmapCoord = lm.width == 0 ? glm::vec2{ 0.0 } : atlas.convertCoord({lm.width, lm.height}, lmPositions[faceIndex], lightmapCoords[i]);
+
+			v.normal = bsp.planes[face.planeIndex].normal;
+			if (face.planeSide)
+				v.normal = -v.normal;
+
+			int edge = bsp.surfEdges[face.firstEdgeIndex + i];
+			if (edge > 0)
+				v.position = bsp.vertices[bsp.edges[edge].vertexIndex[0]];
+			else
+				v.position = bsp.vertices[bsp.edges[-edge].vertexIndex[1]];
+		}
+		geometry.vertexOffsets.push_back(static_cast<unsigned int>(firstIndex));
 	}
 
-	{
-		// decals
-		std::vector<Vertex> vertices;
-
-		for (const auto& decal : m_bsp->m_decals) {
-			for (auto i = 0; i < 6; i++) {
-				auto& v = vertices.emplace_back();
-				v.normal = decal.normal;
-				if (i == 0 || i == 3) { v.position = decal.vec[0]; v.texCoord = glm::vec2(0, 0); }
-				if (i == 1)           { v.position = decal.vec[1]; v.texCoord = glm::vec2(1, 0); }
-				if (i == 2 || i == 4) { v.position = decal.vec[2]; v.texCoord = glm::vec2(1, 1); }
-				if (i == 5)           { v.position = decal.vec[3]; v.texCoord = glm::vec2(0, 1); }
-			}
+	geometry.lightmapAtlas = atlas.img();
+	return geometry;
+}
+
+void BspRenderable::uploadStaticGeometry(std::span<const VertexWithLM> vertices, ImageView lightmapAtlas) {
+	m_lightmapAtlas = m_renderer.createTexture({ lightmapAtlas });
+
+	m_staticGeometryVbo = m_renderer.createBuffer(vertices.size() * sizeof(VertexWithLM), vertices.data());
+	m_staticGeometryVao = m_renderer.createInputLayout(*m_staticGeometryVbo, {
+		render::AttributeLayout{ "POSITION", 0, 3, render::AttributeLayout::Type::Float, sizeof(VertexWithLM), offsetof(VertexWithLM, position     ) },
+		render::AttributeLayout{ "NORMAL"  , 0, 3, render::AttributeLayout::Type::Float, sizeof(VertexWithLM), offsetof(VertexWithLM, normal       ) },
+		render::AttributeLayout{ "TEXCOORD", 0, 2, render::AttributeLayout::Type::Float, sizeof(VertexWithLM), offsetof(VertexWithLM, texCoord     ) },
+		render::AttributeLayout{ "TEXCOORD", 1, 2, render::AttributeLayout::Type::Float, sizeof(VertexWithLM), offsetof(VertexWithLM, lightmapCoord) },
+		render::AttributeLayout{ "TEXCOORD", 2, 1, render::AttributeLayout::Type::Float, sizeof(VertexWithLM), offsetof(VertexWithLM, texLayer     ) }
+	});
+}
+
+void BspRenderable::buildDecalBuffer() {
+	const auto atlas = buildDecalAtlas(*m_bsp);
+	if (!atlas.levels.empty())
+		m_decalAtlas = m_renderer.createTexture(std::vector<ImageView>(begin(atlas.levels), end(atlas.levels)));
+
+	// two triangles per decal
+	std::vector<Vertex> vertices;
+	for (const auto& decal : m_bsp->m_decals) {
+		const auto& [offset, size] = atlas.placement.at(decal.texIndex);
+		for (const auto corner : {0, 1, 2, 0, 2, 3}) {
+			auto& v = vertices.emplace_back();
+			v.position = decal.vec[corner];
+			v.normal = decal.normal;
+			v.texCoord = offset + size * glm::vec2(corner == 1 || corner == 2, corner >= 2);
 		}
 
-		m_decalVbo = m_renderer.createBuffer(vertices.size() * sizeof(Vertex), vertices.data());
-		m_decalVao = m_renderer.createInputLayout(*m_decalVbo, {
-			render::AttributeLayout{ "POSITION", 0, 3, render::AttributeLayout::Type::Float, sizeof(Vertex), offsetof(Vertex, position) },
-			render::AttributeLayout{ "NORMAL"  , 0, 3, render::AttributeLayout::Type::Float, sizeof(Vertex), offsetof(Vertex, normal  ) },
-			render::AttributeLayout{ "TEXCOORD", 0, 2, render::AttributeLayout::Type::Float, sizeof(Vertex), offsetof(Vertex, texCoord) },
-			render::AttributeLayout{ "TEXCOORD", 1, 2, render::AttributeLayout::Type::Float, sizeof(Vertex), offsetof(Vertex, texCoord) }, // we do not need this one
-		});
+		// the decal was placed on a face of the leaf containing its origin
+		const auto leaf = m_bsp->findLeaf((decal.vec[0] + decal.vec[2]) * 0.5f);
+		m_decalLeaves.push_back(leaf.value_or(0));
 	}
+
+	m_decalVbo = m_renderer.createBuffer(vertices.size() * sizeof(Vertex), vertices.data());
+	m_decalVao = m_renderer.createInputLayout(*m_decalVbo, {
+		render::AttributeLayout{ "POSITION", 0, 3, render::AttributeLayout::Type::Float, sizeof(Vertex), offsetof(Vertex, position) },
+		render::AttributeLayout{ "NORMAL"  , 0, 3, render::AttributeLayout::Type::Float, sizeof(Vertex), offsetof(Vertex, normal  ) },
+		render::AttributeLayout{ "TEXCOORD", 0, 2, render::AttributeLayout::Type::Float, sizeof(Vertex), offsetof(Vertex, texCoord) },
+		render::AttributeLayout{ "TEXCOORD", 1, 2, render::AttributeLayout::Type::Float, sizeof(Vertex), offsetof(Vertex, texCoord) }, // we do not need this one
+	});
 }
@@ -1,49 +1,102 @@
 #pragma once
 
-#include <boost/dynamic_bitset.hpp>
-
+#include <functional>
+#include <memory>
 #include <optional>
+#include <span>
+#include <unordered_map>
 
+#include "BlockCompression.h"
 #include "IRenderable.h"
 #include "bspdef.h"
 #include "mathlib.h"
 #include "IRenderer.h"
+#include "TextureResidency.h"
+#include "Vis.h"
 
 class Bsp;
 class Camera;
 class Entity;
+struct MipmapTexture;
+
+// GPU textures by content hash, shared by all BspRenderables of a renderer (e.g. of the current and the next map)
+using TextureCache = std::unordered_map<std::uint64_t, std::weak_ptr<render::ITexture>>;
 
 class BspRenderable : public IRenderable {
 public:
-	BspRenderable(render::IRenderer& renderer, const Bsp& bsp, const Camera& camera);
+	struct Vertex {
+		glm::vec3 position;
+		glm::vec3 normal;
+		glm::vec2 texCoord;
+	};
+
+	struct VertexWithLM : Vertex {
+		glm::vec2 lightmapCoord;
+		float texLayer = 0; // layer of the face's texture in its texture array
+	};
+
+	// World textures grouped by size into texture arrays, so faces of different textures can be drawn without rebinding
+	struct TextureArrayLayout {
+		static constexpr unsigned int maxLayers = 256; // minimum GL_MAX_ARRAY_TEXTURE_LAYERS
+
+		struct Bucket {
+			unsigned int width, height, layers = 0;
+		};
+
+		std::vector<Bucket> buckets;
+		std::vector<int> bucketOf;          // per miptexture, -1 if it is not part of an array
+		std::vector<unsigned int> layerOf; // per miptexture
+	};
+
+	// Everything needed for the static geometry which can be computed without a renderer
+	struct StaticGeometry {
+		std::vector<VertexWithLM> vertices; // triangle list of all faces
+		std::vector<unsigned int> vertexOffsets; // first vertex of each face
+		Image lightmapAtlas;
+	};
+
+	BspRenderable(render::IRenderer& renderer, const Bsp& bsp, const Camera& camera, TextureCache& textureCache, std::optional<StaticGeometry> geometry = {}); // geometry may be prebuilt, e.g. while preloading
 	~BspRenderable();
 
+	static auto buildStaticGeometry(const Bsp& bsp) -> StaticGeometry;
+	static auto textureArrayLayout(const Bsp& bsp) -> TextureArrayLayout; // depends only on the miptexture headers, so cached geometry stays valid
+
 	virtual void render(const RenderSettings& settings) override;
 
 private:
 	void loadTextures();
-	auto loadLightmaps() -> std::vector<std::vector<glm::vec2>>;
+	struct MipChain;
+	struct ChainJob;
+	static auto fullMipChain(std::shared_ptr<const MipmapTexture> mipTex, bool compress = false, std::optional<BlockFormat> format = {}) -> std::shared_ptr<const MipChain>; // RGBA levels down to 1x1, also block compressed if compress
+	static auto lowResMipChain(std::shared_ptr<const MipmapTexture> mipTex) -> std::shared_ptr<const MipChain>; // the smallest stored level and the levels below it
+	auto mipChainJob(std::size_t texIndex) const -> std::function<std::shared_ptr<const MipChain>()>; // prepares the levels a texture is uploaded with on any thread, empty if no full chain is needed
+	auto isArrayed(std::size_t texIndex) const -> bool;
+	void startChainJob(std::size_t texIndex, std::function<std::shared_ptr<const MipChain>()> job);
+	auto takePreparedChain(std::size_t texIndex) -> std::optional<std::shared_ptr<const MipChain>>; // nothing while the job runs, null if it failed
+
+	auto uploadTexture(const std::shared_ptr<const MipmapTexture>& mipTex, std::shared_ptr<const MipChain> chain = {}) -> std::shared_ptr<render::ITexture>; // reuses a texture with the same content from the cache. chain may be prepared already.
+	auto uploadLowResTexture(const std::shared_ptr<const MipmapTexture>& mipTex) -> std::shared_ptr<render::ITexture>; // the smallest levels, shown while a texture is not resident
+	auto uploadWorldTexture(std::size_t texIndex, std::shared_ptr<const MipChain> chain = {}) -> std::shared_ptr<render::ITexture>; // at the resolution chosen by m_residency
+	void updateResidency();
+	void createTextureArrays();
+	void uploadArrayLayer(std::size_t texIndex, const MipmapTexture& mipTex, std::shared_ptr<const MipChain> chain = {}, bool async = false);
+	void uploadArrayLayerPlaceholder(std::size_t texIndex);
+	void swapInReadyTextures(); // replaces placeholders of textures which finished loading in the background
+	void setTexture(std::size_t texIndex, std::shared_ptr<render::ITexture> tex); // keeps the current texture or a placeholder until tex is uploaded
+	void swapInUploadedTextures();
 	void loadSkyTextures();
 
 	void renderSkybox();
-	auto renderStaticGeometry(glm::vec3 pos) -> std::vector<render::FaceRenderInfo>;
+	auto renderStaticGeometry(glm::vec3 pos, const VisRow* visList) -> std::vector<render::FaceRenderInfo>;
+	auto visibleDecals(const VisRow* visList) const -> std::vector<render::FaceRenderInfo>; // all decals if visList is null
 	//void renderLeafOutlines();
 	void renderLeaf(int iLeaf, std::vector<render::FaceRenderInfo>& fri);                                                                  // Renders a leaf of the BSP tree by rendering each face of the leaf by the given index
-	void renderBSP(int node, const boost::dynamic_bitset<std::uint8_t>& visList, glm::vec3 pos, std::vector<render::FaceRenderInfo>& fri); // Recursively walks through the BSP tree and draws it
+	void renderBSP(int node, const VisRow* visList, glm::vec3 pos, std::vector<render::FaceRenderInfo>& fri); // Recursively walks through the BSP tree and draws it
 
-	void buildBuffers(std::vector<std::vector<glm::vec2>>&& lmCoords);
+	void uploadStaticGeometry(std::span<const VertexWithLM> vertices, ImageView lightmapAtlas);
+	void buildDecalBuffer(); // and the decal atlas
 
 private:
-	struct Vertex {
-		glm::vec3 position;
-		glm::vec3 normal;
-		glm::vec2 texCoord;
-	};
-
-	struct VertexWithLM : Vertex {
-		glm::vec2 lightmapCoord;
-	};
-
 	render::IRenderer& m_renderer;
 	const Bsp* m_bsp;
 	const Camera* m_camera;
@@ -51,8 +104,20 @@ private:
 	const RenderSettings* m_settings = nullptr;
 
 	std::optional<std::unique_ptr<render::ITexture>> m_skyboxTex;
-	std::vector<std::unique_ptr<render::ITexture>> m_textures;
+	TextureCache& m_textureCache;
+	std::vector<std::shared_ptr<render::ITexture>> m_textures;
+	std::vector<std::size_t> m_pendingTextures; // indices of m_textures still showing a placeholder
+	std::unordered_map<std::size_t, std::shared_ptr<ChainJob>> m_chainJobs; // levels of pending and promoted textures being prepared on the pool
+	std::vector<std::size_t> m_promotingTextures; // indices of m_textures promoted by m_residency whose full chain is being prepared
+	std::vector<std::pair<std::size_t, std::shared_ptr<render::ITexture>>> m_uploadingTextures; // indices of m_textures and their replacements still uploading
+	std::shared_ptr<render::ITexture> m_placeholder;
+	std::optional<TextureResidency> m_residency; // manages the world textures if there is a texture budget
+	TextureArrayLayout m_arrayLayout;
+	render::TextureArrayFormat m_arrayFormat = render::TextureArrayFormat::RGBA8;
+	std::vector<std::unique_ptr<render::ITexture>> m_textureArrays; // per bucket of m_arrayLayout, empty if the renderer does not support arrays
 	std::unique_ptr<render::ITexture> m_lightmapAtlas;
+	std::unique_ptr<render::ITexture> m_decalAtlas; // null if the map has no decals
+	std::vector<int> m_decalLeaves; // leaf of each decal for PVS culling, 0 if unknown
 
 	std::unique_ptr<render::IBuffer> m_staticGeometryVbo;
 	std::unique_ptr<render::IBuffer> m_decalVbo;
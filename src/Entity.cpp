@@ -1,31 +1,104 @@
 #include "Entity.h"
 
-Entity::Entity(const std::string& propertiesString) {
+#include <charconv>
+#include <cstring>
+
+namespace {
+	// memchr is vectorized by the C runtime, so scanning for quotes skips long values quickly
+	auto findChar(std::string_view s, std::size_t pos, char c) -> std::size_t {
+		if (pos >= s.size())
+			return std::string_view::npos;
+		const auto* p = static_cast<const char*>(std::memchr(s.data() + pos, c, s.size() - pos));
+		return p ? static_cast<std::size_t>(p - s.data()) : std::string_view::npos;
+	}
+}
+
+auto Entity::findProperty(std::string_view name) const -> std::optional<std::string_view> {
+	// entities have only a handful of properties, a linear scan beats hashing
+	for (const auto& p : m_properties)
+		if (p.key == name)
+			return p.value;
+	return {};
+}
+
+auto parseEntities(std::string_view lump, std::vector<EntityProperty>& properties) -> std::vector<Entity> {
+	struct Range {
+		std::size_t first, count;
+	};
+	std::vector<Range> ranges;
+
 	std::size_t pos = 0;
-	while (true) {
-		auto readQuotedString = [&] {
-			pos++;
-			auto end = propertiesString.find('"', pos);
-			auto s = propertiesString.substr(pos, end - pos);
-			pos = end + 1;
-			return s;
-		};
-
-		pos = propertiesString.find('"', pos);
-		if (pos == std::string::npos)
-			break;
-
-		auto name = readQuotedString();
-		pos = propertiesString.find('"', pos);
-		auto value = readQuotedString();
-		properties.emplace(std::move(name), std::move(value));
+	while ((pos = findChar(lump, pos, '{')) != std::string_view::npos) {
+		const auto first = properties.size();
+		pos++;
+		while (true) {
+			// the entity ends at the first closing brace outside of a quoted string
+			const auto quote = findChar(lump, pos, '"');
+			const auto close = findChar(lump.substr(0, quote == std::string_view::npos ? lump.size() : quote), pos, '}');
+			if (close != std::string_view::npos) {
+				pos = close + 1;
+				break;
+			}
+			if (quote == std::string_view::npos) {
+				pos = lump.size();
+				break;
+			}
+
+			const auto readQuoted = [&](std::size_t open) -> std::optional<std::string_view> {
+				const auto end = findChar(lump, open + 1, '"');
+				if (end == std::string_view::npos)
+					return {};
+				pos = end + 1;
+				return lump.substr(open + 1, end - open - 1);
+			};
+
+			const auto key = readQuoted(quote);
+			const auto valueQuote = key ? findChar(lump, pos, '"') : std::string_view::npos;
+			const auto value = valueQuote != std::string_view::npos ? readQuoted(valueQuote) : std::nullopt;
+			if (!value) {
+				pos = lump.size(); // truncated lump
+				break;
+			}
+			properties.push_back({*key, *value});
+		}
+		ranges.push_back({first, properties.size() - first});
 	}
+
+	std::vector<Entity> entities;
+	entities.reserve(ranges.size());
+	for (const auto& r : ranges)
+		entities.emplace_back(std::span<const EntityProperty>{properties}.subspan(r.first, r.count));
+	return entities;
+}
+
+namespace {
+	void skipSpace(std::string_view& s) {
+		while (!s.empty() && (s.front() == ' ' || s.front() == '\t' || s.front() == '+'))
+			s.remove_prefix(1);
+	}
+
+	template<typename T>
+	auto parseNumber(std::string_view& s) -> T {
+		skipSpace(s);
+		T t{};
+		const auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), t);
+		s.remove_prefix(end - s.data());
+		return ec == std::errc{} ? t : T{};
+	}
+}
+
+auto parseInt(std::string_view s) -> int {
+	return parseNumber<int>(s);
+}
+
+auto parseFloat(std::string_view s) -> float {
+	return parseNumber<float>(s);
 }
 
-// TODO This will need to be modified later when there are more than one of the same type
-auto Entity::findProperty(const std::string& name) const -> const std::string* {
-	const auto it = properties.find(name);
-	if (it != end(properties))
-		return &it->second;
-	return nullptr;
+auto parseVec3(std::string_view s) -> glm::vec3 {
+	glm::vec3 v;
+	v.x = parseNumber<float>(s);
+	v.y = parseNumber<float>(s);
+	v.z = parseNumber<float>(s);
+	return v;
 }
@@ -1,13 +1,34 @@
 #pragma once
 
-#include <string>
-#include <unordered_map>
+#include <glm/vec3.hpp>
 
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+struct EntityProperty {
+	std::string_view key;
+	std::string_view value;
+};
+
+// An entity of the entity lump. Keys and values are views into the lump, which must outlive the entity.
 class Entity {
 public:
-	explicit Entity(const std::string& propertiesString);
-	auto findProperty(const std::string& name) const -> const std::string*;
+	explicit Entity(std::span<const EntityProperty> properties)
+		: m_properties(properties) {}
+
+	auto findProperty(std::string_view name) const -> std::optional<std::string_view>; // first property with the given key
+	auto properties() const -> std::span<const EntityProperty> { return m_properties; }
 
 private:
-	std::unordered_map<std::string, std::string> properties;
+	std::span<const EntityProperty> m_properties;
 };
+
+// Parses all entities of an entity lump ({ "key" "value" ... } blocks) without copying any strings.
+// The entities view into properties, which must not be modified afterwards.
+auto parseEntities(std::string_view lump, std::vector<EntityProperty>& properties) -> std::vector<Entity>;
+
+auto parseInt(std::string_view s) -> int;         // leading integer of s, 0 if there is none
+auto parseFloat(std::string_view s) -> float;     // leading number of s, 0 if there is none
+auto parseVec3(std::string_view s) -> glm::vec3;  // three whitespace separated numbers, missing ones are 0
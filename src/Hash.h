@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+
+// 64 bit FNV-1a, used for content hashes of files and texture data
+constexpr auto fnv1aOffsetBasis = std::uint64_t{14695981039346656037ull};
+
+inline auto fnv1a64(std::span<const std::uint8_t> data, std::uint64_t hash = fnv1aOffsetBasis) -> std::uint64_t {
+	for (const auto b : data) {
+		hash ^= b;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
@@ -1,9 +1,18 @@
 #pragma once
 
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <cstdint>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <istream>
 #include <iterator>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 namespace fs = std::filesystem;
@@ -32,6 +41,16 @@ auto readVector(std::istream& is, std::size_t count) {
 	return v;
 }
 
+template<typename T>
+void write(std::ostream& os, const T& t) {
+	os.write(reinterpret_cast<const char*>(&t), sizeof(T));
+}
+
+template<typename T>
+void writeVector(std::ostream& os, std::span<const T> v) {
+	os.write(reinterpret_cast<const char*>(v.data()), sizeof(T) * v.size());
+}
+
 inline auto readTextFile(const fs::path& filename) {
 	std::string content;
 	std::ifstream file(filename);
@@ -43,3 +62,86 @@ inline auto readTextFile(const fs::path& filename) {
 	content.assign(std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{});
 	return content;
 }
+
+/// @brief Read-only memory mapping of a whole file or of a section of one
+/// Sections of the file (e.g. the lumps of a BSP file or the directory of a WAD file) are exposed as typed, bounds-checked views directly into the mapping, so nothing is copied.
+/// The underlying storage is reference counted, views stay valid as long as any MappedFile sharing it is alive (also across copies and moves).
+class MappedFile {
+public:
+	MappedFile() = default;
+	explicit MappedFile(const fs::path& path) {
+		namespace bip = boost::interprocess;
+		if (!fs::is_regular_file(path))
+			throw std::ios::failure("Failed to open file " + path.string() + " for reading");
+		if (fs::file_size(path) == 0)
+			return;
+		try {
+			struct Mapping {
+				bip::file_mapping file;
+				bip::mapped_region region;
+			};
+			auto mapping = std::make_shared<Mapping>();
+			mapping->file = bip::file_mapping(path.string().c_str(), bip::read_only);
+			mapping->region = bip::mapped_region(mapping->file, bip::read_only);
+			m_bytes = {static_cast<const std::uint8_t*>(mapping->region.get_address()), mapping->region.get_size()};
+			m_storage = std::move(mapping);
+		} catch (const bip::interprocess_exception& e) {
+			throw std::ios::failure("Failed to map file " + path.string() + ": " + e.what());
+		}
+	}
+
+	// Wraps memory kept alive by storage, e.g. a decompressed archive entry
+	MappedFile(std::shared_ptr<const void> storage, std::span<const std::uint8_t> bytes)
+		: m_storage(std::move(storage)), m_bytes(bytes) {}
+
+	auto bytes() const -> std::span<const std::uint8_t> {
+		return m_bytes;
+	}
+
+	auto size() const -> std::size_t {
+		return m_bytes.size();
+	}
+
+	// Keeps the bytes alive, e.g. for views which outlive this object
+	auto storage() const -> const std::shared_ptr<const void>& {
+		return m_storage;
+	}
+
+	// A section of this file sharing the same storage
+	auto section(std::size_t offset, std::size_t length) const -> MappedFile {
+		return {m_storage, {checkedRange(offset, length), length}};
+	}
+
+	template<typename T>
+	auto read(std::size_t offset) const -> T {
+		T t;
+		std::memcpy(&t, checkedRange(offset, sizeof(T)), sizeof(T));
+		return t;
+	}
+
+	template<typename T>
+	auto view(std::size_t offset, std::size_t count) const -> std::span<const T> {
+		const auto* p = checkedRange(offset, count * sizeof(T));
+		if (reinterpret_cast<std::uintptr_t>(p) % alignof(T) != 0)
+			throw std::runtime_error("Misaligned view at offset " + std::to_string(offset));
+		return {reinterpret_cast<const T*>(p), count};
+	}
+
+	/// Views a section of length bytes as an array of T. Trailing bytes not filling a whole T are ignored.
+	template<typename T>
+	auto lumpView(std::int64_t offset, std::int64_t length) const -> std::span<const T> {
+		if (offset < 0 || length < 0)
+			throw std::out_of_range("Negative lump offset or length");
+		return view<T>(static_cast<std::size_t>(offset), static_cast<std::size_t>(length) / sizeof(T));
+	}
+
+private:
+	auto checkedRange(std::size_t offset, std::size_t length) const -> const std::uint8_t* {
+		if (offset > size() || length > size() - offset)
+			throw std::out_of_range("Range [" + std::to_string(offset) + ", " + std::to_string(offset + length) + ") exceeds mapped file of " + std::to_string(size()) + " bytes");
+		return bytes().data() + offset;
+	}
+
+	std::shared_ptr<const void> m_storage;
+	std::span<const std::uint8_t> m_bytes;
+};
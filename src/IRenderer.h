@@ -7,13 +7,15 @@
 #include <vector>
 
 #include "Image.h"
+#include "Palette.h"
 #include "bspdef.h"
 
 struct GLFWwindow;
 struct GLFWmonitor;
 
 class Camera;
-struct Decal;
+struct MipmapTexture;
+struct CompressedImage;
 struct ImDrawData;
 struct RenderSettings;
 
@@ -33,6 +35,12 @@ namespace render {
 		~IInputLayout() = default;
 	};
 
+	enum class TextureArrayFormat {
+		RGBA8,
+		BC3,
+		Indexed, // palette indices, with one 256 entry palette per layer
+	};
+
 	struct FaceRenderInfo {
 		render::ITexture* tex;
 		unsigned int offset;
@@ -64,14 +72,34 @@ namespace render {
 		virtual void resizeViewport(int width, int height) = 0;
 		virtual void clear() = 0;
 
-		virtual auto createTexture(const std::vector<Image>& mipmaps) const -> std::unique_ptr<ITexture> = 0;
-		virtual auto createCubeTexture(const std::array<Image, 6>& sides) const -> std::unique_ptr<ITexture> = 0;
+		virtual auto createTexture(const std::vector<ImageView>& mipmaps) const -> std::unique_ptr<ITexture> = 0;
+
+		// Textures whose levels are uploaded over the next frames, so loading many of them does not stall frame submission.
+		// They must not be drawn before textureReady returns true. flushUploads advances the pending uploads and is called once per frame.
+		// owner keeps the viewed pixels alive until they are uploaded.
+		virtual auto createTextureAsync(std::vector<ImageView> mipmaps, std::shared_ptr<const void> owner) -> std::unique_ptr<ITexture> = 0;
+		virtual auto textureReady(const ITexture& texture) const -> bool = 0;
+		virtual void flushUploads() = 0;
+		virtual auto createPalettizedTexture(const MipmapTexture& mipTex) const -> std::unique_ptr<ITexture> = 0; // mipTex.palette must be set
+		virtual auto supportsBlockCompression() const -> bool = 0; // BC1 and BC3
+		virtual auto createCompressedTexture(const std::vector<CompressedImage>& mipmaps) const -> std::unique_ptr<ITexture> = 0;
+
+		// Arrays of equally sized textures with a full mip chain, or bsp30::MIPLEVELS levels if indexed. Faces drawn with an array texture select the layer per vertex.
+		virtual auto supportsTextureArrays() const -> bool = 0;
+		virtual auto createTextureArray(TextureArrayFormat format, unsigned int width, unsigned int height, unsigned int layers) const -> std::unique_ptr<ITexture> = 0;
+		virtual void setTextureArrayLayer(ITexture& array, unsigned int layer, const std::vector<ImageView>& mipmaps, const PaletteLut* palette) const = 0; // palette is required for indexed arrays
+		virtual void setTextureArrayLayer(ITexture& array, unsigned int layer, const std::vector<CompressedImage>& mipmaps) const = 0;
+		// Like setTextureArrayLayer, but the levels are uploaded over the next frames like those of createTextureAsync and the layer keeps its previous levels until then.
+		// textureReady on the array returns true once all its layers are uploaded. Not for indexed arrays.
+		virtual void setTextureArrayLayerAsync(ITexture& array, unsigned int layer, std::vector<ImageView> mipmaps, std::shared_ptr<const void> owner) = 0;
+		virtual void setTextureArrayLayerAsync(ITexture& array, unsigned int layer, std::shared_ptr<const std::vector<CompressedImage>> mipmaps) = 0;
+		virtual auto createCubeTexture(const std::array<ImageView, 6>& sides) const -> std::unique_ptr<ITexture> = 0;
 		virtual auto createBuffer(std::size_t size, const void* data) const -> std::unique_ptr<IBuffer> = 0;
 		virtual auto createInputLayout(IBuffer& buffer, const std::vector<AttributeLayout>& layout) const -> std::unique_ptr<IInputLayout> = 0;
 
 		virtual void renderCoords(const glm::mat4& matrix) = 0;
 		virtual void renderSkyBox(ITexture& cubemap, const glm::mat4& matrix) = 0;
-		virtual void renderStatic(std::vector<EntityData> entities, const std::vector<Decal>& decals, IInputLayout& staticLayout, IInputLayout& decalLayout, std::vector<std::unique_ptr<render::ITexture>>& textures, render::ITexture& lightmapAtlas, const RenderSettings& settings) = 0;
+		virtual void renderStatic(std::vector<EntityData> entities, std::vector<FaceRenderInfo> decals, IInputLayout& staticLayout, IInputLayout& decalLayout, render::ITexture& lightmapAtlas, const RenderSettings& settings) = 0; // decals are drawn from the decal layout with alpha blending
 		virtual void renderImgui(ImDrawData* data) = 0;
 
 		virtual auto screenshot() const -> Image = 0;
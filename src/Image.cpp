@@ -1,30 +1,105 @@
 #include "Image.h"
 
+#include <algorithm>
+
+#include "Archive.h"
+#include "Simd.h"
+
+#ifdef HLBSP_X86
+#include <immintrin.h>
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+namespace {
+	// Copies the common channels of count texels, channels only in dst are left untouched
+	void convertChannelsScalar(const std::uint8_t* src, unsigned int srcChannels, std::uint8_t* dst, unsigned int dstChannels, std::size_t count) {
+		const auto common = std::min(srcChannels, dstChannels);
+		for (std::size_t i = 0; i < count; i++)
+			std::copy_n(src + i * srcChannels, common, dst + i * dstChannels);
+	}
+
+#ifdef HLBSP_X86
+	// RGB to RGBA, 4 texels per shuffle. The alpha bytes are kept by blending them back from dst.
+	HLBSP_TARGET("ssse3")
+	void convertChannelsSsse3(const std::uint8_t* src, unsigned int srcChannels, std::uint8_t* dst, unsigned int dstChannels, std::size_t count) {
+		std::size_t i = 0;
+		if (srcChannels == 3 && dstChannels == 4) {
+			const auto shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+			const auto alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+			for (; i + 6 <= count; i += 4) { // the load reads 16 of the 18 bytes of 6 texels
+				auto* out = reinterpret_cast<__m128i*>(dst + i * 4);
+				const auto rgb = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3)), shuffle);
+				_mm_storeu_si128(out, _mm_or_si128(rgb, _mm_and_si128(_mm_loadu_si128(out), alpha)));
+			}
+		}
+		convertChannelsScalar(src + i * srcChannels, srcChannels, dst + i * dstChannels, dstChannels, count - i);
+	}
+
+	HLBSP_TARGET("avx2")
+	void convertChannelsAvx2(const std::uint8_t* src, unsigned int srcChannels, std::uint8_t* dst, unsigned int dstChannels, std::size_t count) {
+		std::size_t i = 0;
+		if (srcChannels == 3 && dstChannels == 4) {
+			const auto shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+			const auto alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000u));
+			for (; i + 10 <= count; i += 8) { // the second load reads 16 of the 18 bytes of texels 4 to 9
+				auto* out = reinterpret_cast<__m256i*>(dst + i * 4);
+				const auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3));
+				const auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 3 + 12));
+				const auto rgb = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), shuffle);
+				_mm256_storeu_si256(out, _mm256_or_si256(rgb, _mm256_and_si256(_mm256_loadu_si256(out), alpha)));
+			}
+		}
+		convertChannelsSsse3(src + i * srcChannels, srcChannels, dst + i * dstChannels, dstChannels, count - i);
+	}
+#endif
+
+	const SimdKernel<void(const std::uint8_t*, unsigned int, std::uint8_t*, unsigned int, std::size_t)> convertChannels{
+		convertChannelsScalar,
+		{
+#ifdef HLBSP_X86
+			{SimdLevel::Sse42, convertChannelsSsse3},
+			{SimdLevel::Avx2, convertChannelsAvx2},
+#endif
+		}};
+}
+
 Image::Image(unsigned int width, unsigned int height, unsigned int channels)
 	: width(width), height(height), channels(channels), data(width * height * channels) {}
 
-Image::Image(const Image& img, unsigned int channels)
+ImageView::ImageView(const std::uint8_t* data, unsigned int width, unsigned int height, unsigned int channels, std::size_t rowPitch)
+	: data(data), width(width), height(height), channels(channels), rowPitch(rowPitch != 0 ? rowPitch : std::size_t{width} * channels) {}
+
+ImageView::ImageView(const Image& img)
+	: ImageView(img.data.data(), img.width, img.height, img.channels) {}
+
+Image::Image(ImageView img)
+	: Image(img.width, img.height, img.channels) {
+	const auto rowBytes = std::size_t{width} * channels;
+	for (auto y = 0u; y < height; y++)
+		std::copy_n(img.row(y).data(), rowBytes, &data[y * rowBytes]);
+}
+
+Image::Image(ImageView img, unsigned int channels)
 	: Image(img.width, img.height, channels) {
-	const auto count = std::min(img.channels, channels);
-	for (auto y = 0; y < height; y++) {
-		for (auto x = 0; x < width; x++) {
-			auto src = img(x, y);
-			auto dst = (*this)(x, y);
-			std::copy(src, src + count, dst);
-		}
-	}
+	for (auto y = 0u; y < height; y++)
+		convertChannels(img.row(y).data(), img.channels, data.data() + std::size_t{y} * width * channels, channels, width);
+}
+
+Image::Image(const fs::path& path) try
+	: Image(openFile(path).bytes()) {
+} catch (const std::exception& e) {
+	throw std::ios::failure("Failed to load image file: " + path.string() + ": " + e.what());
 }
 
-Image::Image(const fs::path& path) {
+Image::Image(std::span<const std::uint8_t> encoded) {
 	int x, y, n;
-	auto d = stbi_load(path.string().c_str(), &x, &y, &n, 0);
+	auto d = stbi_load_from_memory(encoded.data(), static_cast<int>(encoded.size()), &x, &y, &n, 0);
 	if (!d)
-		throw std::ios::failure("Failed to load image file: " + path.string());
+		throw std::ios::failure(std::string("Failed to decode image: ") + stbi_failure_reason());
 
 	width = x;
 	height = y;
@@ -1,17 +1,41 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <filesystem>
+#include <span>
 #include <vector>
 
 namespace fs = std::filesystem;
 
+class Image;
+
+// Non-owning view of pixels with rows row pitch bytes apart, e.g. of an Image or of a mapped file
+struct ImageView {
+	const std::uint8_t* data = nullptr;
+	unsigned int width = 0;
+	unsigned int height = 0;
+	unsigned int channels = 0;
+	std::size_t rowPitch = 0;
+
+	ImageView() = default;
+	ImageView(const std::uint8_t* data, unsigned int width, unsigned int height, unsigned int channels, std::size_t rowPitch = 0); // 0 for tightly packed rows
+	ImageView(const Image& img);
+
+	auto operator()(unsigned int x, unsigned int y) const -> const std::uint8_t* { return data + y * rowPitch + x * channels; }
+	auto row(unsigned int y) const -> std::span<const std::uint8_t> { return {data + y * rowPitch, std::size_t{width} * channels}; }
+	auto tight() const -> bool { return rowPitch == std::size_t{width} * channels; }
+	auto bytes() const -> std::span<const std::uint8_t> { return {data, height == 0 ? 0 : rowPitch * (height - 1) + std::size_t{width} * channels}; } // including the padding between rows
+};
+
 class Image {
 public:
 	Image() = default;
 	Image(unsigned int width, unsigned int height, unsigned int channels);
-	explicit Image(const fs::path& path);
-	Image(const Image& img, unsigned int channels);
+	explicit Image(const fs::path& path); // from a mounted archive or the file system
+	explicit Image(std::span<const std::uint8_t> encoded); // decodes an image file held in memory
+	Image(ImageView img, unsigned int channels); // converts the channel count, missing channels are zero
+	explicit Image(ImageView img);               // copies the pixels
 	Image(const Image&) = default;
 	auto operator=(const Image&) -> Image& = default;
 	Image(Image&&) = default;
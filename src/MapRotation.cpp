@@ -0,0 +1,57 @@
+#include "MapRotation.h"
+
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+MapRotation::MapRotation(std::vector<fs::path> maps)
+	: m_maps(std::move(maps)) {
+	if (m_maps.empty())
+		throw std::runtime_error("No map to show");
+	m_current = std::make_unique<Bsp>(m_maps.front(), LoadOptions{.progressive = true});
+	if (m_maps.size() > 1)
+		preload(1);
+}
+
+MapRotation::~MapRotation() {
+	if (m_next.valid())
+		m_next.wait();
+}
+
+auto MapRotation::takeGeometry() -> std::optional<BspRenderable::StaticGeometry> {
+	return std::exchange(m_geometry, std::nullopt);
+}
+
+auto MapRotation::nextReady() const -> bool {
+	return m_next.valid() && m_next.wait_for(std::chrono::seconds{0}) == std::future_status::ready;
+}
+
+auto MapRotation::advance() -> std::unique_ptr<Bsp> {
+	if (!nextReady())
+		return nullptr;
+
+	const auto index = m_nextIndex;
+	auto next = std::move(m_next);
+	preload((index + 1) % m_maps.size());
+	try {
+		auto loaded = next.get();
+		m_index = index;
+		m_geometry = std::move(loaded.geometry);
+		return std::exchange(m_current, std::move(loaded.bsp));
+	} catch (const std::exception& e) {
+		std::clog << "Failed to preload " << m_maps[index] << ": " << e.what() << "\n";
+		return nullptr;
+	}
+}
+
+void MapRotation::preload(std::size_t index) {
+	m_nextIndex = index;
+	m_next = std::async(std::launch::async, [path = m_maps[index]] {
+		std::clog << "Preloading " << path << "\n";
+		Preloaded p;
+		p.bsp = std::make_unique<Bsp>(path);
+		if (!p.bsp->runtimeCache())
+			p.geometry = BspRenderable::buildStaticGeometry(*p.bsp);
+		return p;
+	});
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <future>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "Bsp.h"
+#include "BspRenderable.h"
+
+/// @brief The maps shown one after another
+/// While the current map is in use, the next one is loaded on a worker thread including its static geometry, so switching maps does not block.
+class MapRotation {
+public:
+	explicit MapRotation(std::vector<fs::path> maps); // loads the first map progressively and starts preloading the second
+	~MapRotation();
+
+	auto current() -> Bsp& { return *m_current; }
+	auto takeGeometry() -> std::optional<BspRenderable::StaticGeometry>; // static geometry of the current map if it was built while preloading
+
+	auto nextReady() const -> bool; // true if there is a next map and it finished loading
+
+	// Makes the preloaded next map current and starts preloading the one after it. Does not block, returns nullptr if the next map is not ready yet.
+	// Otherwise returns the previous map, which must be kept alive until nothing refers to it anymore.
+	auto advance() -> std::unique_ptr<Bsp>;
+
+private:
+	struct Preloaded {
+		std::unique_ptr<Bsp> bsp;
+		std::optional<BspRenderable::StaticGeometry> geometry;
+	};
+
+	void preload(std::size_t index);
+
+	std::vector<fs::path> m_maps;
+	std::size_t m_index = 0;
+	std::unique_ptr<Bsp> m_current;
+	std::optional<BspRenderable::StaticGeometry> m_geometry;
+	std::future<Preloaded> m_next;
+	std::size_t m_nextIndex = 0;
+};
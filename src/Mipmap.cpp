@@ -0,0 +1,130 @@
+#include "Mipmap.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <stdexcept>
+
+#include "Simd.h"
+
+#ifdef HLBSP_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+	auto isOpaque(ImageView rgba) {
+		for (auto y = 0u; y < rgba.height; y++) {
+			const auto row = rgba.row(y);
+			for (auto i = 3u; i < row.size(); i += 4)
+				if (row[i] != 255)
+					return false;
+		}
+		return true;
+	}
+
+	// Rounded average of 2x2 blocks of two rows into width texels
+	void boxFilterRowScalar(const std::uint8_t* row0, const std::uint8_t* row1, std::uint8_t* out, unsigned int width) {
+		for (auto x = 0u; x < width; x++)
+			for (auto c = 0; c < 4; c++)
+				out[x * 4 + c] = static_cast<std::uint8_t>((row0[x * 8 + c] + row0[x * 8 + 4 + c] + row1[x * 8 + c] + row1[x * 8 + 4 + c] + 2) / 4);
+	}
+
+#ifdef HLBSP_X86
+	HLBSP_TARGET("sse2")
+	void boxFilterRowSse2(const std::uint8_t* row0, const std::uint8_t* row1, std::uint8_t* out, unsigned int width) {
+		// 4 source texels of both rows per step, giving 2 destination texels
+		const auto zero = _mm_setzero_si128();
+		const auto two = _mm_set1_epi16(2);
+		auto x = 0u;
+		for (; x + 2 <= width; x += 2) {
+			const auto a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + x * 8));
+			const auto b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + x * 8));
+			const auto lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)); // columns 0 and 1
+			const auto hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)); // columns 2 and 3
+			const auto sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+			const auto avg = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + x * 4), _mm_packus_epi16(avg, avg));
+		}
+		boxFilterRowScalar(row0 + x * 8, row1 + x * 8, out + x * 4, width - x);
+	}
+#endif
+
+	const SimdKernel<void(const std::uint8_t*, const std::uint8_t*, std::uint8_t*, unsigned int)> boxFilterRow{
+		boxFilterRowScalar,
+		{
+#ifdef HLBSP_X86
+			{SimdLevel::Sse42, boxFilterRowSse2},
+#endif
+		}};
+
+	// Rounded average of 2x2 blocks, for images with even dimensions
+	void boxFilterOpaque(ImageView src, Image& dst) {
+		for (auto y = 0u; y < dst.height; y++)
+			boxFilterRow(src(0, y * 2), src(0, y * 2 + 1), dst(0, y), dst.width);
+	}
+
+	// Alpha weighted average of up to 2x2 blocks. Blocks without any coverage keep the plain average of their colors,
+	// which are the dilated edge colors of the transparent texels.
+	void boxFilterWeighted(ImageView src, Image& dst) {
+		for (auto y = 0u; y < dst.height; y++) {
+			const auto y0 = std::min(y * 2, src.height - 1);
+			const auto y1 = std::min(y * 2 + 1, src.height - 1);
+			for (auto x = 0u; x < dst.width; x++) {
+				const auto x0 = std::min(x * 2, src.width - 1);
+				const auto x1 = std::min(x * 2 + 1, src.width - 1);
+				const std::uint8_t* texels[] = {src(x0, y0), src(x1, y0), src(x0, y1), src(x1, y1)};
+
+				unsigned int alpha = 0;
+				unsigned int weighted[3] = {};
+				unsigned int plain[3] = {};
+				for (const auto* t : texels) {
+					alpha += t[3];
+					for (auto c = 0; c < 3; c++) {
+						weighted[c] += t[c] * t[3];
+						plain[c] += t[c];
+					}
+				}
+
+				auto* out = dst(x, y);
+				for (auto c = 0; c < 3; c++)
+					out[c] = static_cast<std::uint8_t>(alpha > 0 ? (weighted[c] + alpha / 2) / alpha : (plain[c] + 2) / 4);
+				out[3] = static_cast<std::uint8_t>((alpha + 2) / 4);
+			}
+		}
+	}
+}
+
+auto mipLevelCount(unsigned int width, unsigned int height) -> unsigned int {
+	return static_cast<unsigned int>(std::bit_width(std::max({width, height, 1u})));
+}
+
+auto downsample(ImageView rgba) -> Image {
+	if (rgba.channels != 4)
+		throw std::logic_error("Only RGBA images can be downsampled");
+
+	Image result(std::max(rgba.width / 2, 1u), std::max(rgba.height / 2, 1u), 4);
+	if (rgba.width % 2 == 0 && rgba.height % 2 == 0 && isOpaque(rgba))
+		boxFilterOpaque(rgba, result);
+	else
+		boxFilterWeighted(rgba, result);
+	return result;
+}
+
+auto missingMipLevels(std::span<const ImageView> levels) -> std::vector<Image> {
+	std::vector<Image> missing;
+	if (levels.empty())
+		return missing;
+	const auto count = mipLevelCount(levels.front().width, levels.front().height);
+	for (auto last = levels.back(); levels.size() + missing.size() < count; last = missing.back()) {
+		if (last.width == 1 && last.height == 1)
+			break; // the given levels did not halve
+		missing.push_back(downsample(last));
+	}
+	return missing;
+}
+
+void completeMipChain(std::vector<Image>& levels) {
+	const std::vector<ImageView> views(begin(levels), end(levels));
+	for (auto& level : missingMipLevels(views))
+		levels.push_back(std::move(level));
+}
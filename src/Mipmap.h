@@ -0,0 +1,19 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include "Image.h"
+
+// Number of levels of a full mip chain down to 1x1
+auto mipLevelCount(unsigned int width, unsigned int height) -> unsigned int;
+
+// Halves an RGBA image with a 2x2 box filter. Colors are weighted by alpha, so transparent texels of alpha tested
+// textures do not darken or tint their opaque neighbours.
+auto downsample(ImageView rgba) -> Image;
+
+// Levels downsampled from the last of the given ones until the chain ends at 1x1
+auto missingMipLevels(std::span<const ImageView> levels) -> std::vector<Image>;
+
+// Appends the missing levels
+void completeMipChain(std::vector<Image>& levels);
@@ -0,0 +1,109 @@
+#include "Palette.h"
+
+#include <cstring>
+
+#ifdef HLBSP_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+	auto texel(std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint8_t a) {
+		const std::uint8_t bytes[] = {r, g, b, a};
+		std::uint32_t t;
+		std::memcpy(&t, bytes, sizeof(t));
+		return t;
+	}
+
+	void expandScalar(std::span<const std::uint8_t> indices, const PaletteLut& lut, std::uint8_t* rgba) {
+		for (const auto i : indices) {
+			std::memcpy(rgba, &lut[i], 4);
+			rgba += 4;
+		}
+	}
+
+#ifdef HLBSP_X86
+	HLBSP_TARGET("sse4.1")
+	void expandSse4(std::span<const std::uint8_t> indices, const PaletteLut& lut, std::uint8_t* rgba) {
+		// no gather before AVX2, but 16 indices are loaded at once and the texels are written as full vectors
+		const auto* l = reinterpret_cast<const int*>(lut.data());
+		std::size_t i = 0;
+		for (; i + 16 <= indices.size(); i += 16) {
+			const auto idx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices.data() + i));
+			const auto t0 = _mm_setr_epi32(l[_mm_extract_epi8(idx, 0)], l[_mm_extract_epi8(idx, 1)], l[_mm_extract_epi8(idx, 2)], l[_mm_extract_epi8(idx, 3)]);
+			const auto t1 = _mm_setr_epi32(l[_mm_extract_epi8(idx, 4)], l[_mm_extract_epi8(idx, 5)], l[_mm_extract_epi8(idx, 6)], l[_mm_extract_epi8(idx, 7)]);
+			const auto t2 = _mm_setr_epi32(l[_mm_extract_epi8(idx, 8)], l[_mm_extract_epi8(idx, 9)], l[_mm_extract_epi8(idx, 10)], l[_mm_extract_epi8(idx, 11)]);
+			const auto t3 = _mm_setr_epi32(l[_mm_extract_epi8(idx, 12)], l[_mm_extract_epi8(idx, 13)], l[_mm_extract_epi8(idx, 14)], l[_mm_extract_epi8(idx, 15)]);
+			auto* dst = reinterpret_cast<__m128i*>(rgba + i * 4);
+			_mm_storeu_si128(dst + 0, t0);
+			_mm_storeu_si128(dst + 1, t1);
+			_mm_storeu_si128(dst + 2, t2);
+			_mm_storeu_si128(dst + 3, t3);
+		}
+		expandScalar(indices.subspan(i), lut, rgba + i * 4);
+	}
+
+	HLBSP_TARGET("avx2")
+	void expandAvx2(std::span<const std::uint8_t> indices, const PaletteLut& lut, std::uint8_t* rgba) {
+		const auto* l = reinterpret_cast<const int*>(lut.data());
+		std::size_t i = 0;
+		for (; i + 32 <= indices.size(); i += 32) {
+			const auto idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices.data() + i));
+			const auto lo = _mm256_castsi256_si128(idx);
+			const auto hi = _mm256_extracti128_si256(idx, 1);
+			auto* dst = reinterpret_cast<__m256i*>(rgba + i * 4);
+			_mm256_storeu_si256(dst + 0, _mm256_i32gather_epi32(l, _mm256_cvtepu8_epi32(lo), 4));
+			_mm256_storeu_si256(dst + 1, _mm256_i32gather_epi32(l, _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)), 4));
+			_mm256_storeu_si256(dst + 2, _mm256_i32gather_epi32(l, _mm256_cvtepu8_epi32(hi), 4));
+			_mm256_storeu_si256(dst + 3, _mm256_i32gather_epi32(l, _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)), 4));
+		}
+		expandScalar(indices.subspan(i), lut, rgba + i * 4);
+	}
+
+	HLBSP_TARGET("avx512f")
+	void expandAvx512(std::span<const std::uint8_t> indices, const PaletteLut& lut, std::uint8_t* rgba) {
+		const auto* l = reinterpret_cast<const int*>(lut.data());
+		std::size_t i = 0;
+		for (; i + 64 <= indices.size(); i += 64) {
+			auto* dst = reinterpret_cast<__m512i*>(rgba + i * 4);
+			for (auto j = 0; j < 4; j++) {
+				const auto idx = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(indices.data() + i + j * 16)));
+				_mm512_storeu_si512(dst + j, _mm512_i32gather_epi32(idx, l, 4));
+			}
+		}
+		expandScalar(indices.subspan(i), lut, rgba + i * 4);
+	}
+#endif
+
+	const SimdKernel<void(std::span<const std::uint8_t>, const PaletteLut&, std::uint8_t*)> expandKernel{
+		expandScalar,
+		{
+#ifdef HLBSP_X86
+			{SimdLevel::Sse42, expandSse4},
+			{SimdLevel::Avx2, expandAvx2},
+			{SimdLevel::Avx512, expandAvx512},
+#endif
+		}};
+}
+
+auto makeTextureLut(const std::uint8_t* palette) -> PaletteLut {
+	PaletteLut lut;
+	for (auto i = 0; i < 256; i++)
+		lut[i] = texel(palette[i * 3 + 0], palette[i * 3 + 1], palette[i * 3 + 2], 255);
+	return lut;
+}
+
+auto makeDecalLut(const std::uint8_t* palette) -> PaletteLut {
+	const auto* color = palette + 255 * 3;
+	PaletteLut lut;
+	for (auto i = 0; i < 256; i++)
+		lut[i] = texel(color[0], color[1], color[2], static_cast<std::uint8_t>(255 - palette[i * 3]));
+	return lut;
+}
+
+void expandPalette(std::span<const std::uint8_t> indices, const PaletteLut& lut, std::uint8_t* rgba) {
+	expandKernel(indices, lut, rgba);
+}
+
+void expandPalette(std::span<const std::uint8_t> indices, const PaletteLut& lut, std::uint8_t* rgba, SimdLevel level) {
+	expandKernel[level](indices, lut, rgba);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+
+#include "Simd.h"
+
+// Expansion of 8 bit palettized miptex texels to RGBA
+
+using PaletteLut = std::array<std::uint32_t, 256>; // RGBA texel of every palette index, bytes in memory order
+
+auto makeTextureLut(const std::uint8_t* palette) -> PaletteLut; // opaque palette colors, palette holds 256 RGB entries
+auto makeDecalLut(const std::uint8_t* palette) -> PaletteLut;   // the last palette color with an alpha of 255 minus the red channel of each entry
+
+// Writes the RGBA texel of every index to rgba, which must hold 4 * indices.size() bytes
+void expandPalette(std::span<const std::uint8_t> indices, const PaletteLut& lut, std::uint8_t* rgba);
+void expandPalette(std::span<const std::uint8_t> indices, const PaletteLut& lut, std::uint8_t* rgba, SimdLevel level); // with the kernel of the given level, for comparisons
@@ -0,0 +1,113 @@
+#include "Simd.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#if defined(HLBSP_X86) && defined(_MSC_VER)
+#include <immintrin.h>
+#include <intrin.h>
+#endif
+
+namespace {
+#ifdef HLBSP_X86
+#ifdef _MSC_VER
+	auto cpuid(int leaf, int subleaf = 0) -> std::array<int, 4> {
+		std::array<int, 4> info;
+		__cpuidex(info.data(), leaf, subleaf);
+		return info;
+	}
+#endif
+
+	auto cpuHasSse42() -> bool {
+#ifdef _MSC_VER
+		return cpuid(1)[2] & (1 << 20);
+#else
+		return __builtin_cpu_supports("sse4.2");
+#endif
+	}
+
+	auto cpuHasAvx2() -> bool {
+#ifdef _MSC_VER
+		if (cpuid(0)[0] < 7)
+			return false;
+		const auto info = cpuid(1);
+		const bool osxsave = info[2] & (1 << 27);
+		const bool avx = info[2] & (1 << 28);
+		if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) // OS saves the YMM registers
+			return false;
+		return cpuid(7)[1] & (1 << 5);
+#else
+		return __builtin_cpu_supports("avx2");
+#endif
+	}
+
+	auto cpuHasAvx512() -> bool {
+#ifdef _MSC_VER
+		if (!cpuHasAvx2() || (_xgetbv(0) & 0xE6) != 0xE6) // OS saves the opmask and ZMM registers
+			return false;
+		const auto ebx = cpuid(7)[1];
+		return (ebx & (1 << 16)) && (ebx & (1 << 30));
+#else
+		return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+	}
+#endif
+
+	std::atomic<SimdLevel> activeLevel{detectedSimdLevel()};
+}
+
+auto simdLevelSupported(SimdLevel level) -> bool {
+	switch (level) {
+		case SimdLevel::Scalar: return true;
+#ifdef HLBSP_X86
+		case SimdLevel::Sse42: return cpuHasSse42();
+		case SimdLevel::Avx2: return cpuHasSse42() && cpuHasAvx2();
+		case SimdLevel::Avx512: return cpuHasSse42() && cpuHasAvx512();
+#else
+		default: return false;
+#endif
+	}
+	return false;
+}
+
+auto detectedSimdLevel() -> SimdLevel {
+	static const auto detected = [] {
+#if defined(HLBSP_X86) && defined(__GNUC__)
+		__builtin_cpu_init(); // may run before the constructors of libgcc
+#endif
+		auto best = SimdLevel::Scalar;
+		for (const auto level : simdLevels)
+			if (simdLevelSupported(level))
+				best = level;
+		return best;
+	}();
+	return detected;
+}
+
+auto simdLevel() -> SimdLevel {
+	return activeLevel.load(std::memory_order_relaxed);
+}
+
+void setSimdLevel(SimdLevel level) {
+	if (!simdLevelSupported(level))
+		throw std::runtime_error(std::string("SIMD level ") + simdLevelName(level) + " is not supported by this CPU");
+	activeLevel.store(level, std::memory_order_relaxed);
+}
+
+auto simdLevelName(SimdLevel level) -> const char* {
+	switch (level) {
+		case SimdLevel::Scalar: return "scalar";
+		case SimdLevel::Sse42: return "sse4.2";
+		case SimdLevel::Avx2: return "avx2";
+		case SimdLevel::Avx512: return "avx512";
+	}
+	return "unknown";
+}
+
+auto parseSimdLevel(std::string_view name) -> std::optional<SimdLevel> {
+	for (const auto level : simdLevels)
+		if (name == simdLevelName(level))
+			return level;
+	return {};
+}
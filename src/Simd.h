@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <initializer_list>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+// Runtime selection of SIMD kernels. Kernels are compiled for several instruction set levels in the same binary
+// and called through function pointers chosen for the level the CPU supports, or the one forced with --simd.
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define HLBSP_X86
+#endif
+
+#if defined(__GNUC__)
+#define HLBSP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define HLBSP_TARGET(isa) // MSVC allows intrinsics of any instruction set
+#endif
+
+enum class SimdLevel {
+	Scalar,
+	Sse42,
+	Avx2,
+	Avx512, // F and BW
+};
+
+constexpr auto simdLevelCount = 4;
+constexpr SimdLevel simdLevels[simdLevelCount] = {SimdLevel::Scalar, SimdLevel::Sse42, SimdLevel::Avx2, SimdLevel::Avx512};
+
+auto simdLevelSupported(SimdLevel level) -> bool; // by the CPU and the OS
+auto detectedSimdLevel() -> SimdLevel;           // highest supported level, determined once
+auto simdLevel() -> SimdLevel;                    // level kernels are currently selected for, the detected one unless forced
+void setSimdLevel(SimdLevel level);               // throws std::runtime_error if the level is not supported
+auto simdLevelName(SimdLevel level) -> const char*;
+auto parseSimdLevel(std::string_view name) -> std::optional<SimdLevel>;
+
+/// @brief Implementations of one kernel for several SIMD levels
+/// Calls go to the implementation of the highest level not above simdLevel(), so levels without an implementation of their own
+/// fall back to the next lower one and finally to the scalar implementation.
+template <typename Fn>
+class SimdKernel {
+public:
+	SimdKernel(Fn* scalar, std::initializer_list<std::pair<SimdLevel, Fn*>> impls = {}) {
+		m_impls.fill(scalar);
+		for (auto slot = 0; slot < simdLevelCount; slot++) {
+			auto best = SimdLevel::Scalar;
+			for (const auto& [level, impl] : impls)
+				if (impl && static_cast<int>(level) <= slot && level >= best) {
+					m_impls[slot] = impl;
+					best = level;
+				}
+		}
+	}
+
+	auto operator[](SimdLevel level) const -> Fn* { return m_impls[static_cast<int>(level)]; }
+
+	template <typename... Args>
+	auto operator()(Args&&... args) const -> decltype(auto) {
+		return (*this)[simdLevel()](std::forward<Args>(args)...);
+	}
+
+private:
+	std::array<Fn*, simdLevelCount> m_impls;
+};
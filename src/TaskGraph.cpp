@@ -0,0 +1,110 @@
+#include "TaskGraph.h"
+
+#include <condition_variable>
+#include <exception>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+
+auto TaskGraph::add(std::string name, std::function<void()> f, std::vector<TaskId> dependencies) -> TaskId {
+	const auto id = m_tasks.size();
+	for (const auto d : dependencies) {
+		if (d >= id)
+			throw std::logic_error("Task " + name + " depends on a task added after it");
+		m_tasks[d].dependents.push_back(id);
+	}
+
+	auto& t = m_tasks.emplace_back();
+	t.name = std::move(name);
+	t.f = std::move(f);
+	t.dependencyCount = dependencies.size();
+	return id;
+}
+
+void TaskGraph::run(ThreadPool& pool) {
+	using clock = std::chrono::steady_clock;
+	const auto begin = clock::now();
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::size_t finished = 0;
+	std::exception_ptr exception;
+	std::vector<std::size_t> remaining(m_tasks.size());
+	for (auto i = 0u; i < m_tasks.size(); i++) {
+		remaining[i] = m_tasks[i].dependencyCount;
+		m_tasks[i].skipped = false;
+	}
+
+	std::function<void(TaskId, bool)> schedule = [&](TaskId id, bool skip) {
+		auto& task = m_tasks[id];
+		const auto complete = [&, id](bool failed) {
+			std::vector<TaskId> ready;
+			{
+				std::lock_guard lock{mutex};
+				for (const auto d : m_tasks[id].dependents) {
+					if (failed)
+						m_tasks[d].skipped = true;
+					if (--remaining[d] == 0)
+						ready.push_back(d);
+				}
+			}
+			for (const auto d : ready)
+				schedule(d, m_tasks[d].skipped);
+
+			// run() may return as soon as the last task is counted, so nothing must be touched afterwards
+			std::lock_guard lock{mutex};
+			finished++;
+			cv.notify_all();
+		};
+
+		if (skip) {
+			task.skipped = true;
+			complete(true);
+			return;
+		}
+
+		pool.submit([&, id, complete] {
+			auto& task = m_tasks[id];
+			const auto start = clock::now();
+			bool failed = false;
+			try {
+				task.f();
+			} catch (...) {
+				failed = true;
+				std::lock_guard lock{mutex};
+				if (!exception)
+					exception = std::current_exception();
+			}
+			task.start = start - begin;
+			task.duration = clock::now() - start;
+			complete(failed);
+		});
+	};
+
+	for (auto i = 0u; i < m_tasks.size(); i++)
+		if (m_tasks[i].dependencyCount == 0)
+			schedule(i, false);
+
+	std::unique_lock lock{mutex};
+	cv.wait(lock, [&] { return finished == m_tasks.size(); });
+	m_total = clock::now() - begin;
+
+	if (exception)
+		std::rethrow_exception(exception);
+}
+
+void TaskGraph::logTimings(std::ostream& os) const {
+	const auto ms = [](std::chrono::duration<double> d) { return d.count() * 1000.0; };
+	for (const auto& t : m_tasks) {
+		os << "  " << std::left << std::setw(12) << t.name << std::right;
+		if (t.skipped)
+			os << " skipped\n";
+		else
+			os << " +" << std::fixed << std::setprecision(1) << std::setw(7) << ms(t.start) << " ms  " << std::setw(7) << ms(t.duration) << " ms\n";
+	}
+	os << "  total        " << std::fixed << std::setprecision(1) << ms(m_total) << " ms\n";
+	os.unsetf(std::ios::floatfield);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+class ThreadPool;
+
+// A set of named tasks with dependencies between them. Running the graph executes every task on a thread pool as soon as all its dependencies finished.
+class TaskGraph {
+public:
+	using TaskId = std::size_t;
+
+	auto add(std::string name, std::function<void()> f, std::vector<TaskId> dependencies = {}) -> TaskId;
+
+	// Runs all tasks and blocks until they are finished. Tasks depending on a failed task are skipped and the first exception is rethrown.
+	// Must not be called from a job of the given pool.
+	void run(ThreadPool& pool);
+
+	void logTimings(std::ostream& os) const; // Prints start and duration of every task of the last run
+
+private:
+	struct Task {
+		std::string name;
+		std::function<void()> f;
+		std::vector<TaskId> dependents;
+		std::size_t dependencyCount = 0;
+		std::chrono::duration<double> start{};
+		std::chrono::duration<double> duration{};
+		bool skipped = false;
+	};
+
+	std::vector<Task> m_tasks;
+	std::chrono::duration<double> m_total{};
+};
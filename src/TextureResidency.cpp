@@ -0,0 +1,70 @@
+#include "TextureResidency.h"
+
+#include <algorithm>
+
+TextureResidency::TextureResidency(std::size_t budget, unsigned int evictFrames, unsigned int loadsPerFrame)
+	: m_budget(budget), m_evictFrames(evictFrames), m_loadsPerFrame(loadsPerFrame) {}
+
+void TextureResidency::add(std::size_t id, std::size_t fullBytes) {
+	if (id >= m_entries.size())
+		m_entries.resize(id + 1);
+	m_entries[id].bytes = fullBytes;
+}
+
+void TextureResidency::touch(std::size_t id) {
+	auto& e = m_entries[id];
+	if (e.touched)
+		return;
+	e.touched = true;
+	e.lastUse = m_frame;
+	m_touched.push_back(id);
+}
+
+void TextureResidency::evict(std::size_t id, Plan& plan) {
+	auto& e = m_entries[id];
+	e.resident = false;
+	m_residentBytes -= e.bytes;
+	plan.evict.push_back(id);
+}
+
+auto TextureResidency::update(const std::function<bool(std::size_t)>& loadable) -> Plan {
+	Plan plan;
+
+	// textures not drawn for a while
+	for (auto id = 0u; id < m_entries.size(); id++) {
+		const auto& e = m_entries[id];
+		if (e.resident && m_frame - e.lastUse > m_evictFrames)
+			evict(id, plan);
+	}
+
+	// resident textures which may make room, least recently used first
+	std::vector<std::size_t> victims;
+	for (auto id = 0u; id < m_entries.size(); id++)
+		if (m_entries[id].resident && !m_entries[id].touched)
+			victims.push_back(id);
+	std::sort(begin(victims), end(victims), [&](std::size_t a, std::size_t b) { return m_entries[a].lastUse > m_entries[b].lastUse; });
+
+	// drawn textures, nearest first
+	for (const auto id : m_touched) {
+		if (plan.load.size() == m_loadsPerFrame)
+			break;
+		const auto& e = m_entries[id];
+		if (e.resident || !loadable(id))
+			continue;
+		while (m_residentBytes + e.bytes > m_budget && !victims.empty()) {
+			evict(victims.back(), plan);
+			victims.pop_back();
+		}
+		if (m_residentBytes + e.bytes > m_budget)
+			break; // everything left is in view, farther textures stay at low resolution
+		m_entries[id].resident = true;
+		m_residentBytes += e.bytes;
+		plan.load.push_back(id);
+	}
+
+	for (const auto id : m_touched)
+		m_entries[id].touched = false;
+	m_touched.clear();
+	m_frame++;
+	return plan;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+/// @brief Decides which textures are kept at full resolution within a memory budget
+/// Textures start at a low resolution level. The renderer touches every texture it draws, in drawing order, which is front to back for
+/// BSP geometry. Once per frame, update() promotes the touched textures, nearest first, and demotes textures which were not drawn for a
+/// while or, if the budget is exceeded, were drawn least recently. The caller performs the actual uploads.
+class TextureResidency {
+public:
+	static constexpr unsigned int defaultEvictFrames = 300;
+	static constexpr unsigned int defaultLoadsPerFrame = 8; // spreads uploads over frames when many textures appear at once
+
+	TextureResidency(std::size_t budget, unsigned int evictFrames = defaultEvictFrames, unsigned int loadsPerFrame = defaultLoadsPerFrame);
+
+	void add(std::size_t id, std::size_t fullBytes); // registers a texture, ids are dense indices
+	void touch(std::size_t id);                      // the texture is drawn in the current frame
+
+	struct Plan {
+		std::vector<std::size_t> evict; // drop to low resolution
+		std::vector<std::size_t> load;  // upload at full resolution
+	};
+
+	// Ends the current frame. Textures are only loaded if loadable(id) returns true, e.g. once they finished decoding.
+	auto update(const std::function<bool(std::size_t)>& loadable) -> Plan;
+
+	auto resident(std::size_t id) const -> bool { return id < m_entries.size() && m_entries[id].resident; }
+	auto residentBytes() const -> std::size_t { return m_residentBytes; }
+	auto budget() const -> std::size_t { return m_budget; }
+
+private:
+	struct Entry {
+		std::size_t bytes = 0;
+		std::uint64_t lastUse = 0; // frame, 0 if never drawn
+		bool resident = false;
+		bool touched = false;      // in the current frame
+	};
+
+	void evict(std::size_t id, Plan& plan);
+
+	std::size_t m_budget;
+	unsigned int m_evictFrames;
+	unsigned int m_loadsPerFrame;
+	std::uint64_t m_frame = 1;
+	std::size_t m_residentBytes = 0;
+	std::vector<Entry> m_entries;
+	std::vector<std::size_t> m_touched; // in order of the first touch in the current frame
+};
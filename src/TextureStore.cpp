@@ -0,0 +1,87 @@
+#include "TextureStore.h"
+
+#include <algorithm>
+#include <cctype>
+
+#include "Hash.h"
+
+namespace {
+	auto nameKey(std::string_view source, std::string_view name, TextureKind kind) {
+		std::string key;
+		key.reserve(source.size() + name.size() + 3);
+		key += source;
+		key += '/';
+		std::transform(begin(name), end(name), back_inserter(key), [](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+		key += '/';
+		key += static_cast<char>('0' + static_cast<int>(kind));
+		return key;
+	}
+
+	auto contentHash(std::span<const std::uint8_t> raw, TextureKind kind) {
+		// skip the name stored in front of the miptex header
+		const auto k = static_cast<std::uint8_t>(kind);
+		return fnv1a64(raw.subspan(std::min<std::size_t>(raw.size(), bsp30::MAXTEXTURENAME)), fnv1a64({&k, 1}));
+	}
+}
+
+auto TextureStore::shared() -> TextureStore& {
+	static TextureStore store;
+	return store;
+}
+
+auto TextureStore::texture(std::string_view source, std::string_view name, std::span<const std::uint8_t> raw, TextureKind kind) -> std::shared_ptr<const MipmapTexture> {
+	auto key = source.empty() ? std::string{} : nameKey(source, name, kind);
+	const auto hash = contentHash(raw, kind);
+
+	{
+		std::lock_guard lock{m_mutex};
+		if (!key.empty())
+			if (const auto it = m_byName.find(key); it != end(m_byName))
+				if (auto tex = it->second.lock())
+					return tex;
+		if (const auto it = m_byContent.find(hash); it != end(m_byContent))
+			if (auto tex = it->second.lock()) {
+				if (!key.empty())
+					m_byName[std::move(key)] = tex;
+				return tex;
+			}
+	}
+
+	// decode without holding the lock, other threads may decode different textures meanwhile
+	auto decoded = std::make_shared<MipmapTexture>();
+	switch (kind) {
+		case TextureKind::World: Wad::CreateMipTexture(raw, *decoded); break;
+		case TextureKind::Decal: Wad::CreateDecalTexture(raw, *decoded); break;
+		case TextureKind::Palettized: Wad::CreatePalettizedTexture(raw, *decoded); break;
+	}
+	decoded->contentHash = hash;
+	std::shared_ptr<const MipmapTexture> tex = std::move(decoded);
+
+	std::lock_guard lock{m_mutex};
+	auto& byContent = m_byContent[hash];
+	if (auto existing = byContent.lock())
+		tex = std::move(existing); // decoded concurrently by another thread
+	else
+		byContent = tex;
+	if (!key.empty())
+		m_byName[std::move(key)] = tex;
+
+	if (m_byName.size() + m_byContent.size() >= m_purgeAt)
+		purge();
+	return tex;
+}
+
+auto TextureStore::wad(const fs::path& path) -> const Wad& {
+	std::lock_guard lock{m_mutex};
+	auto& wad = m_wads[path.generic_string()];
+	if (!wad)
+		wad = std::make_unique<Wad>(path);
+	return *wad;
+}
+
+void TextureStore::purge() {
+	const auto expired = [](const auto& entry) { return entry.second.expired(); };
+	std::erase_if(m_byName, expired);
+	std::erase_if(m_byContent, expired);
+	m_purgeAt = std::max<std::size_t>(256, 2 * (m_byName.size() + m_byContent.size()));
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "Wad.h"
+
+enum class TextureKind {
+	World, // colors from the palette, blue is transparent
+	Decal, // the last palette color tinted by the texel values
+	Palettized, // like World, but kept as palette indices for the renderer to resolve
+};
+
+/// @brief Process wide store of decoded textures
+/// Textures are looked up by source and name, then by the hash of their raw data, so each texture is decoded once while any map refers to it
+/// and identical textures with different names share one decoded copy.
+class TextureStore {
+public:
+	static auto shared() -> TextureStore&;
+
+	// Returns the decoded texture for the raw miptex data. source names the WAD the texture was read from and may be empty for textures embedded in a BSP.
+	auto texture(std::string_view source, std::string_view name, std::span<const std::uint8_t> raw, TextureKind kind) -> std::shared_ptr<const MipmapTexture>;
+
+	auto wad(const fs::path& path) -> const Wad&; // opens the WAD on first use and keeps it open
+
+private:
+	template<typename Key>
+	using Entries = std::unordered_map<Key, std::weak_ptr<const MipmapTexture>>;
+
+	void purge(); // drops entries of textures no map refers to anymore
+
+	std::mutex m_mutex;
+	Entries<std::string> m_byName;      // "<source>/<lower case name>/<kind>"
+	Entries<std::uint64_t> m_byContent; // hash of the raw texture data and kind
+	std::size_t m_purgeAt = 256;
+	std::unordered_map<std::string, std::unique_ptr<Wad>> m_wads;
+};
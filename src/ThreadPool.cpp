@@ -0,0 +1,47 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+	if (threadCount == 0)
+		threadCount = 1;
+	m_workers.reserve(threadCount);
+	for (auto i = 0u; i < threadCount; i++)
+		m_workers.emplace_back([this] { work(); });
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard lock{m_mutex};
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	for (auto& t : m_workers)
+		t.join();
+}
+
+auto ThreadPool::shared() -> ThreadPool& {
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::submit(std::function<void()> job) {
+	{
+		std::lock_guard lock{m_mutex};
+		m_jobs.push_back(std::move(job));
+	}
+	m_cv.notify_one();
+}
+
+void ThreadPool::work() {
+	while (true) {
+		std::function<void()> job;
+		{
+			std::unique_lock lock{m_mutex};
+			m_cv.wait(lock, [&] { return m_stop || !m_jobs.empty(); });
+			if (m_stop && m_jobs.empty())
+				return;
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		job();
+	}
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+	explicit ThreadPool(unsigned int threadCount = std::thread::hardware_concurrency());
+	ThreadPool(const ThreadPool&) = delete;
+	auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+	~ThreadPool();
+
+	static auto shared() -> ThreadPool&; // Process wide pool with one worker per hardware thread
+
+	auto size() const -> std::size_t { return m_workers.size(); }
+
+	void submit(std::function<void()> job);
+
+	// Calls f(i) for all i in [0, count) on the pool and the calling thread and returns when all calls finished.
+	// The calling thread takes part in the work, so this may also be used from inside a pool job.
+	template<typename F>
+	void parallelFor(std::size_t count, F&& f);
+
+private:
+	void work();
+
+	std::vector<std::thread> m_workers;
+	std::deque<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stop = false;
+};
+
+template<typename F>
+void ThreadPool::parallelFor(std::size_t count, F&& f) {
+	if (count == 0)
+		return;
+
+	struct State {
+		std::atomic<std::size_t> next{0};
+		std::size_t count;
+		std::function<void(std::size_t)> f;
+		std::mutex mutex;
+		std::condition_variable cv;
+		unsigned int active = 0;
+		std::exception_ptr exception;
+	};
+	auto state = std::make_shared<State>();
+	state->count = count;
+	state->f = std::ref(f);
+
+	const auto drain = [](State& s) {
+		for (auto i = s.next++; i < s.count; i = s.next++) {
+			try {
+				s.f(i);
+			} catch (...) {
+				std::lock_guard lock{s.mutex};
+				if (!s.exception)
+					s.exception = std::current_exception();
+			}
+		}
+	};
+
+	// helpers which start after all indices were handed out return immediately and only touch the shared state
+	const auto helpers = std::min<std::size_t>(size(), count - 1);
+	for (std::size_t h = 0; h < helpers; h++) {
+		submit([state, drain] {
+			{
+				std::lock_guard lock{state->mutex};
+				state->active++;
+			}
+			drain(*state);
+			std::lock_guard lock{state->mutex};
+			if (--state->active == 0)
+				state->cv.notify_all();
+		});
+	}
+
+	drain(*state);
+
+	std::unique_lock lock{state->mutex};
+	state->cv.wait(lock, [&] { return state->active == 0; });
+	if (state->exception)
+		std::rethrow_exception(state->exception);
+}
@@ -0,0 +1,115 @@
+#include "Vis.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	// Decodes one run-length encoded PVS row into out. Runs of zeros are encoded as a zero byte followed by the run length.
+	// out is zero initialized, so zero runs only advance the write position and literal runs are copied as a whole.
+	void decodeRow(std::span<const std::uint8_t> in, std::span<std::uint8_t> out) {
+		auto read = in.begin();
+		auto write = out.begin();
+		while (write != out.end() && read != in.end()) {
+			if (*read == 0) {
+				if (++read == in.end())
+					break;
+				write += std::min<std::ptrdiff_t>(*read++, out.end() - write);
+			} else {
+				const auto available = std::min(in.end() - read, out.end() - write);
+				const auto literalEnd = std::find(read, read + available, std::uint8_t{0});
+				write = std::copy(read, literalEnd, write);
+				read = literalEnd;
+			}
+		}
+	}
+}
+
+void VisCache::load(std::span<const std::uint8_t> compressedVis, std::span<const bsp30::Leaf> leaves, std::size_t visLeafCount) {
+	clear();
+	m_compressedVis = compressedVis;
+	m_leaves = leaves;
+	m_visLeafCount = visLeafCount;
+}
+
+void VisCache::load(std::vector<std::span<const std::uint8_t>> rows, std::size_t visLeafCount) {
+	clear();
+	m_rows = std::move(rows);
+	m_visLeafCount = visLeafCount;
+}
+
+void VisCache::clear() {
+	std::lock_guard lock{m_mutex};
+	m_compressedVis = {};
+	m_leaves = {};
+	m_rows.clear();
+	m_visLeafCount = 0;
+	m_lru.clear();
+	m_cache.clear();
+	m_bytes = 0;
+}
+
+auto VisCache::decompress(int leaf) const -> std::shared_ptr<const VisRow> {
+	if (leaf < 1 || static_cast<std::size_t>(leaf) > m_visLeafCount)
+		return nullptr;
+
+	if (!m_rows.empty()) {
+		const auto& src = m_rows[leaf - 1];
+		if (src.empty())
+			return nullptr;
+		auto row = std::make_shared<VisRow>(m_visLeafCount);
+		const auto dst = row->bytes();
+		std::memcpy(dst.data(), src.data(), std::min(src.size(), dst.size()));
+		return row;
+	}
+
+	const auto offset = m_leaves[leaf].visOffset;
+	if (offset < 0 || static_cast<std::size_t>(offset) >= m_compressedVis.size())
+		return nullptr;
+	auto row = std::make_shared<VisRow>(m_visLeafCount);
+	decodeRow(m_compressedVis.subspan(offset), row->bytes());
+	return row;
+}
+
+auto VisCache::row(int leaf) const -> std::shared_ptr<const VisRow> {
+	std::lock_guard lock{m_mutex};
+	if (const auto it = m_cache.find(leaf); it != m_cache.end()) {
+		m_lru.splice(m_lru.begin(), m_lru, it->second.lruPos);
+		return it->second.row;
+	}
+
+	// leaves are numbered in BSP tree order, so the camera most likely moves into an adjacent leaf next
+	fetch(leaf - 1);
+	fetch(leaf + 1);
+	return fetch(leaf);
+}
+
+auto VisCache::fetch(int leaf) const -> std::shared_ptr<const VisRow> {
+	if (const auto it = m_cache.find(leaf); it != m_cache.end()) {
+		m_lru.splice(m_lru.begin(), m_lru, it->second.lruPos);
+		return it->second.row;
+	}
+
+	auto row = decompress(leaf);
+	if (!row)
+		return nullptr;
+	m_lru.push_front(leaf);
+	m_cache.emplace(leaf, Entry{row, m_lru.begin()});
+	m_bytes += row->words().size_bytes();
+	evict();
+	return row;
+}
+
+void VisCache::setBudget(std::size_t bytes) {
+	std::lock_guard lock{m_mutex};
+	m_budget = bytes;
+	evict();
+}
+
+void VisCache::evict() const {
+	while (m_bytes > m_budget && m_lru.size() > 1) {
+		const auto it = m_cache.find(m_lru.back());
+		m_bytes -= it->second.row->words().size_bytes();
+		m_cache.erase(it);
+		m_lru.pop_back();
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "bspdef.h"
+
+// Decompressed potentially visible set of one leaf. Bit i is set if leaf i + 1 is visible.
+class VisRow {
+public:
+	explicit VisRow(std::size_t leafCount)
+		: m_words((leafCount + 63) / 64), m_size(leafCount) {}
+
+	auto size() const -> std::size_t { return m_size; }
+	auto operator[](std::size_t i) const -> bool { return (m_words[i / 64] >> (i % 64)) & 1; }
+
+	auto words() const -> std::span<const std::uint64_t> { return m_words; }
+	auto bytes() const -> std::span<const std::uint8_t> { return {reinterpret_cast<const std::uint8_t*>(m_words.data()), (m_size + 7) / 8}; }
+	auto bytes() -> std::span<std::uint8_t> { return {reinterpret_cast<std::uint8_t*>(m_words.data()), (m_size + 7) / 8}; }
+
+private:
+	std::vector<std::uint64_t> m_words; // little endian, so bit i of the row is bit i % 8 of byte i / 8 as in the BSP file
+	std::size_t m_size;
+};
+
+/// @brief On demand PVS decompression with a bounded LRU cache of decompressed rows
+/// Rows are decoded either from the run-length compressed visibility lump or copied from precompiled rows (e.g. from the runtime cache).
+/// Both sources are views into mapped files and stay resident without being expanded.
+class VisCache {
+public:
+	static constexpr std::size_t defaultBudget = 1024 * 1024;
+
+	void load(std::span<const std::uint8_t> compressedVis, std::span<const bsp30::Leaf> leaves, std::size_t visLeafCount); // rows are run-length decoded
+	void load(std::vector<std::span<const std::uint8_t>> rows, std::size_t visLeafCount);                                   // rows are copied, an empty row means no PVS
+
+	auto empty() const -> bool { return m_visLeafCount == 0; } // true if the map has no VIS
+	auto leafCount() const -> std::size_t { return m_visLeafCount; }
+
+	// Returns the PVS of the given leaf (index into the leaves lump, leaf 0 has no PVS), nullptr if the leaf has no PVS and everything is visible.
+	// Neighbouring leaves are decompressed ahead when the row was not cached yet.
+	auto row(int leaf) const -> std::shared_ptr<const VisRow>;
+
+	auto decompress(int leaf) const -> std::shared_ptr<const VisRow>; // decodes a row bypassing the cache
+
+	void setBudget(std::size_t bytes); // maximum number of bytes held by cached rows, at least the most recently used row is kept
+
+private:
+	auto fetch(int leaf) const -> std::shared_ptr<const VisRow>; // requires m_mutex
+	void clear();
+	void evict() const; // requires m_mutex
+
+	std::span<const std::uint8_t> m_compressedVis;
+	std::span<const bsp30::Leaf> m_leaves;
+	std::vector<std::span<const std::uint8_t>> m_rows;
+	std::size_t m_visLeafCount = 0;
+	std::size_t m_budget = defaultBudget;
+
+	struct Entry {
+		std::shared_ptr<const VisRow> row;
+		std::list<int>::iterator lruPos;
+	};
+	mutable std::mutex m_mutex;
+	mutable std::list<int> m_lru; // most recently used first
+	mutable std::unordered_map<int, Entry> m_cache;
+	mutable std::size_t m_bytes = 0;
+};
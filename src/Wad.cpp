@@ -2,177 +2,217 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include <algorithm>
+#include <array>
 #include <cctype>
+#include <cstddef>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 
-#include "IO.h"
+#include "Archive.h"
+#include "Hash.h"
+#include "Palette.h"
+#include "Simd.h"
 
-namespace {
-	const auto sqrt2 = std::sqrt(2.0);
-
-	void ApplyAlphaSections(Image& pTex) {
-		std::vector<unsigned char> pRGBTexture(pTex.width * pTex.height * 4, 0x00);
-
-		// Color pRGBTexture totally blue
-		for (int i = 0; i < pTex.height * pTex.width; i++)
-			pRGBTexture[i * 4 + 2] = 255;
-
-		for (int y = 0; y < pTex.height; y++) {
-			for (int x = 0; x < pTex.width; x++) {
-				int index = y * pTex.width + x;
-
-				if ((pTex.data[index * 4] == 0) && (pTex.data[index * 4 + 1] == 0) && (pTex.data[index * 4 + 2] == 255)) {
-					// Blue color signifies a transparent portion of the texture. zero alpha for blending and
-					// to get rid of blue edges choose the average color of the nearest non blue pixels
-
-					//First set pixel black and transparent
-					pTex.data[index * 4 + 2] = 0;
-					pTex.data[index * 4 + 3] = 0;
-
-					int count = 0;
-					unsigned int RGBColorSum[3] = {0, 0, 0};
-
-					//left above pixel
-					if ((x > 0) && (y > 0)) {
-						int iPixel = ((y - 1) * pTex.width + (x - 1)) * 4;
-						if (!((pTex.data[iPixel] == 0) && (pTex.data[iPixel + 1] == 0) && (pTex.data[iPixel + 2] == 255))) {
-							RGBColorSum[0] += (unsigned int)((float)pTex.data[iPixel + 0] * sqrt2);
-							RGBColorSum[1] += (unsigned int)((float)pTex.data[iPixel + 1] * sqrt2);
-							RGBColorSum[2] += (unsigned int)((float)pTex.data[iPixel + 2] * sqrt2);
-							count++;
-						}
-					}
-
-					//above pixel
-					if ((x >= 0) && (y > 0)) {
-						int iPixel = ((y - 1) * pTex.width + x) * 4;
-						if (!((pTex.data[iPixel] == 0) && (pTex.data[iPixel + 1] == 0) && (pTex.data[iPixel + 2] == 255))) {
-							RGBColorSum[0] += pTex.data[iPixel];
-							RGBColorSum[1] += pTex.data[iPixel + 1];
-							RGBColorSum[2] += pTex.data[iPixel + 2];
-							count++;
-						}
-					}
+#ifdef HLBSP_X86
+#include <immintrin.h>
+#endif
 
-					//right above pixel
-					if ((x < pTex.width - 1) && (y > 0)) {
-						int iPixel = ((y - 1) * pTex.width + (x + 1)) * 4;
-						if (!((pTex.data[iPixel] == 0) && (pTex.data[iPixel + 1] == 0) && (pTex.data[iPixel + 2] == 255))) {
-							RGBColorSum[0] += (unsigned int)((float)pTex.data[iPixel + 0] * sqrt2);
-							RGBColorSum[1] += (unsigned int)((float)pTex.data[iPixel + 1] * sqrt2);
-							RGBColorSum[2] += (unsigned int)((float)pTex.data[iPixel + 2] * sqrt2);
-							count++;
-						}
-					}
+namespace {
+	// The original weighting of diagonal neighbours, (unsigned int)((float)v * sqrt(2.0)), for every channel value
+	const auto diagonalWeight = [] {
+		std::array<std::uint16_t, 256> weights;
+		for (auto v = 0u; v < 256; v++)
+			weights[v] = static_cast<std::uint16_t>(static_cast<float>(v) * std::sqrt(2.0));
+		return weights;
+	}();
+
+	auto rgbaWord(std::uint8_t r, std::uint8_t g, std::uint8_t b, std::uint8_t a) {
+		const std::uint8_t bytes[] = {r, g, b, a};
+		std::uint32_t word;
+		std::memcpy(&word, bytes, sizeof(word));
+		return word;
+	}
 
-					//left pixel
-					if (x > 0) {
-						int iPixel = (y * pTex.width + (x - 1)) * 4;
-						if (!((pTex.data[iPixel] == 0) && (pTex.data[iPixel + 1] == 0) && (pTex.data[iPixel + 2] == 255))) {
-							RGBColorSum[0] += pTex.data[iPixel];
-							RGBColorSum[1] += pTex.data[iPixel + 1];
-							RGBColorSum[2] += pTex.data[iPixel + 2];
-							count++;
-						}
-					}
+	const auto keyColor = rgbaWord(0, 0, 255, 0); // pure blue marks transparent texels, alpha is ignored
+	const auto rgbBits = rgbaWord(255, 255, 255, 0);
 
-					//right pixel
-					if (x < pTex.width - 1) {
-						int iPixel = (y * pTex.width + (x + 1)) * 4;
-						if (!((pTex.data[iPixel] == 0) && (pTex.data[iPixel + 1] == 0) && (pTex.data[iPixel + 2] == 255))) {
-							RGBColorSum[0] += pTex.data[iPixel];
-							RGBColorSum[1] += pTex.data[iPixel + 1];
-							RGBColorSum[2] += pTex.data[iPixel + 2];
-							count++;
-						}
-					}
+	auto hasKeyColor(const PaletteLut& lut) {
+		return std::any_of(begin(lut), end(lut), [](std::uint32_t t) { return (t & rgbBits) == keyColor; });
+	}
 
-					//left underneath pixel
-					if ((x > 0) && (y < pTex.height - 1)) {
-						int iPixel = ((y + 1) * pTex.width + (x - 1)) * 4;
-						if (!((pTex.data[iPixel] == 0) && (pTex.data[iPixel + 1] == 0) && (pTex.data[iPixel + 2] == 255))) {
-							RGBColorSum[0] += (unsigned int)((float)pTex.data[iPixel + 0] * sqrt2);
-							RGBColorSum[1] += (unsigned int)((float)pTex.data[iPixel + 1] * sqrt2);
-							RGBColorSum[2] += (unsigned int)((float)pTex.data[iPixel + 2] * sqrt2);
-							count++;
-						}
-					}
+	// Sets mask[i] to 0xFF for every key colored texel and 0 otherwise. Returns true if there is any.
+	auto buildKeyMaskScalar(const std::uint8_t* rgba, std::size_t count, std::uint8_t* mask) -> bool {
+		bool any = false;
+		for (std::size_t i = 0; i < count; i++) {
+			std::uint32_t t;
+			std::memcpy(&t, rgba + i * 4, sizeof(t));
+			mask[i] = (t & rgbBits) == keyColor ? 0xFF : 0;
+			any |= mask[i] != 0;
+		}
+		return any;
+	}
 
-					//underneath pixel
-					if ((x >= 0) && (y < pTex.height - 1)) {
-						int iPixel = ((y + 1) * pTex.width + x) * 4;
-						if (!((pTex.data[iPixel] == 0) && (pTex.data[iPixel + 1] == 0) && (pTex.data[iPixel + 2] == 255))) {
-							RGBColorSum[0] += pTex.data[iPixel];
-							RGBColorSum[1] += pTex.data[iPixel + 1];
-							RGBColorSum[2] += pTex.data[iPixel + 2];
-							count++;
-						}
-					}
+#ifdef HLBSP_X86
+	HLBSP_TARGET("sse2")
+	auto buildKeyMaskSse2(const std::uint8_t* rgba, std::size_t count, std::uint8_t* mask) -> bool {
+		const auto bits = _mm_set1_epi32(static_cast<int>(rgbBits));
+		const auto key = _mm_set1_epi32(static_cast<int>(keyColor));
+		auto anyKey = _mm_setzero_si128();
+		std::size_t i = 0;
+		for (; i + 16 <= count; i += 16) {
+			const auto* src = reinterpret_cast<const __m128i*>(rgba + i * 4);
+			const auto e0 = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(src + 0), bits), key);
+			const auto e1 = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(src + 1), bits), key);
+			const auto e2 = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(src + 2), bits), key);
+			const auto e3 = _mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(src + 3), bits), key);
+			const auto m = _mm_packs_epi16(_mm_packs_epi32(e0, e1), _mm_packs_epi32(e2, e3));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(mask + i), m);
+			anyKey = _mm_or_si128(anyKey, m);
+		}
+		const auto any = _mm_movemask_epi8(anyKey) != 0;
+		return buildKeyMaskScalar(rgba + i * 4, count - i, mask + i) || any;
+	}
 
-					//right underneath pixel
-					if ((x < pTex.width - 1) && (y < pTex.height - 1)) {
-						int iPixel = ((y + 1) * pTex.width + (x + 1)) * 4;
-						if (!((pTex.data[iPixel] == 0) && (pTex.data[iPixel + 1] == 0) && (pTex.data[iPixel + 2] == 255))) {
-							RGBColorSum[0] += (unsigned int)((float)pTex.data[iPixel + 0] * sqrt2);
-							RGBColorSum[1] += (unsigned int)((float)pTex.data[iPixel + 1] * sqrt2);
-							RGBColorSum[2] += (unsigned int)((float)pTex.data[iPixel + 2] * sqrt2);
-							count++;
-						}
-					}
+	HLBSP_TARGET("avx2")
+	auto buildKeyMaskAvx2(const std::uint8_t* rgba, std::size_t count, std::uint8_t* mask) -> bool {
+		const auto bits = _mm256_set1_epi32(static_cast<int>(rgbBits));
+		const auto key = _mm256_set1_epi32(static_cast<int>(keyColor));
+		const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7); // the packs work within 128 bit lanes
+		auto anyKey = _mm256_setzero_si256();
+		std::size_t i = 0;
+		for (; i + 32 <= count; i += 32) {
+			const auto* src = reinterpret_cast<const __m256i*>(rgba + i * 4);
+			const auto e0 = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_loadu_si256(src + 0), bits), key);
+			const auto e1 = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_loadu_si256(src + 1), bits), key);
+			const auto e2 = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_loadu_si256(src + 2), bits), key);
+			const auto e3 = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_loadu_si256(src + 3), bits), key);
+			const auto packed = _mm256_packs_epi16(_mm256_packs_epi32(e0, e1), _mm256_packs_epi32(e2, e3));
+			const auto m = _mm256_permutevar8x32_epi32(packed, order);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(mask + i), m);
+			anyKey = _mm256_or_si256(anyKey, m);
+		}
+		const auto any = _mm256_movemask_epi8(anyKey) != 0;
+		return buildKeyMaskScalar(rgba + i * 4, count - i, mask + i) || any;
+	}
 
-					if (count > 0) {
-						RGBColorSum[0] /= count;
-						RGBColorSum[1] /= count;
-						RGBColorSum[2] /= count;
+	HLBSP_TARGET("avx512f")
+	auto buildKeyMaskAvx512(const std::uint8_t* rgba, std::size_t count, std::uint8_t* mask) -> bool {
+		const auto bits = _mm512_set1_epi32(static_cast<int>(rgbBits));
+		const auto key = _mm512_set1_epi32(static_cast<int>(keyColor));
+		const auto ones = _mm512_set1_epi32(-1);
+		__mmask16 anyKey = 0;
+		std::size_t i = 0;
+		for (; i + 16 <= count; i += 16) {
+			const auto k = _mm512_cmpeq_epi32_mask(_mm512_and_si512(_mm512_loadu_si512(rgba + i * 4), bits), key);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(mask + i), _mm512_cvtepi32_epi8(_mm512_maskz_mov_epi32(k, ones)));
+			anyKey |= k;
+		}
+		return buildKeyMaskScalar(rgba + i * 4, count - i, mask + i) || anyKey != 0;
+	}
+#endif
 
-						pRGBTexture[index * 4 + 0] = RGBColorSum[0];
-						pRGBTexture[index * 4 + 1] = RGBColorSum[1];
-						pRGBTexture[index * 4 + 2] = RGBColorSum[2];
+	const SimdKernel<bool(const std::uint8_t*, std::size_t, std::uint8_t*)> buildKeyMask{
+		buildKeyMaskScalar,
+		{
+#ifdef HLBSP_X86
+			{SimdLevel::Sse42, buildKeyMaskSse2},
+			{SimdLevel::Avx2, buildKeyMaskAvx2},
+			{SimdLevel::Avx512, buildKeyMaskAvx512},
+#endif
+		}};
+
+	// Blue texels are transparent. They get zero alpha and, to avoid blue edges when filtered, the average color of their
+	// non blue neighbours, with diagonal neighbours weighted by sqrt(2). Blue neighbours before a texel in scan order count as
+	// black, blue neighbours after it are ignored, which reproduces the results of the former two buffer implementation.
+	void ApplyAlphaSections(Image& img) {
+		const auto width = img.width;
+		const auto height = img.height;
+		thread_local std::vector<std::uint8_t> mask; // reused, so textures do not allocate once it has grown
+		if (mask.size() < std::size_t{width} * height)
+			mask.resize(std::size_t{width} * height);
+		if (!buildKeyMask(img.data.data(), std::size_t{width} * height, mask.data()))
+			return;
+
+		for (auto y = 0u; y < height; y++) {
+			for (auto x = 0u; x < width; x++) {
+				const auto index = y * width + x;
+				if (!mask[index])
+					continue;
+
+				int count = 0;
+				unsigned int sum[3] = {0, 0, 0};
+				const auto add = [&](unsigned int nx, unsigned int ny, bool diagonal, bool before) {
+					const auto n = ny * width + nx;
+					if (mask[n]) {
+						if (before)
+							count++; // already black
+						return;
 					}
+					const auto* p = &img.data[n * 4];
+					for (auto c = 0; c < 3; c++)
+						sum[c] += diagonal ? diagonalWeight[p[c]] : p[c];
+					count++;
+				};
+				if (y > 0) {
+					if (x > 0)
+						add(x - 1, y - 1, true, true);
+					add(x, y - 1, false, true);
+					if (x < width - 1)
+						add(x + 1, y - 1, true, true);
+				}
+				if (x > 0)
+					add(x - 1, y, false, true);
+				if (x < width - 1)
+					add(x + 1, y, false, false);
+				if (y < height - 1) {
+					if (x > 0)
+						add(x - 1, y + 1, true, false);
+					add(x, y + 1, false, false);
+					if (x < width - 1)
+						add(x + 1, y + 1, true, false);
 				}
-			}
-		}
-
-		//Merge pTex and pRGBTexture
-		for (int y = 0; y < pTex.height; y++) {
-			for (int x = 0; x < pTex.width; x++) {
-				int index = y * pTex.width + x;
 
-				if ((pRGBTexture[index * 4] != 0) || (pRGBTexture[index * 4 + 1] != 0) || (pRGBTexture[index * 4 + 2] != 255) || (pRGBTexture[index * 4 + 3] != 0))
-					memcpy(&pTex.data[index * 4], &pRGBTexture[index * 4], sizeof(unsigned char) * 4);
+				// black and transparent, unless the average is set and not blue itself
+				auto* p = &img.data[index * 4];
+				std::memset(p, 0, 4);
+				if (count > 0) {
+					const std::uint8_t avg[] = {static_cast<std::uint8_t>(sum[0] / count), static_cast<std::uint8_t>(sum[1] / count), static_cast<std::uint8_t>(sum[2] / count)};
+					if (avg[0] != 0 || avg[1] != 0 || avg[2] != 255)
+						std::memcpy(p, avg, 3);
+				}
 			}
 		}
 	}
 
-	auto texNameLess(const char* a, const char* b) {
-#ifdef WIN32
-		return _stricmp(a, b) < 0;
-#else
-		return strcasecmp(a, b) < 0;
-#endif
+	auto toLower(char c) -> unsigned char {
+		return static_cast<unsigned char>(std::tolower(static_cast<unsigned char>(c)));
 	}
+}
 
-	auto texNameEqual(const char* a, const char* b) {
-#ifdef WIN32
-		return _stricmp(a, b) == 0;
-#else
-		return strcasecmp(a, b) == 0;
-#endif
+auto TextureNameHash::operator()(std::string_view name) const -> std::size_t {
+	// FNV-1a over the lower case name
+	auto hash = fnv1aOffsetBasis;
+	for (const auto c : name) {
+		hash ^= toLower(c);
+		hash *= 1099511628211ull;
 	}
+	return static_cast<std::size_t>(hash);
+}
+
+auto TextureNameEqual::operator()(std::string_view a, std::string_view b) const -> bool {
+	return std::equal(begin(a), end(a), begin(b), end(b), [](char x, char y) { return toLower(x) == toLower(y); });
 }
 
 Wad::Wad(const fs::path& path)
-	: wadFile(path, std::ios::binary) {
-	if (!wadFile)
-		throw std::ios::failure("Failed to open file " + path.string() + " for reading");
-	wadFile.exceptions(std::ios::badbit | std::ios::failbit);
+	: wadFile(openFile(path)) {
 	LoadDirectory();
 }
 
-auto Wad::loadTexture(const char* name) -> std::optional<MipmapTexture> {
-	auto rawTex = GetTexture(name);
+auto Wad::loadTexture(const char* name) const -> std::optional<MipmapTexture> {
+	const auto rawTex = GetTexture(name);
 	if (rawTex.empty())
 		return {};
 
@@ -181,8 +221,8 @@ auto Wad::loadTexture(const char* name) -> std::optional<MipmapTexture> {
 	return tex;
 }
 
-auto Wad::LoadDecalTexture(const char* name) -> std::optional<MipmapTexture> {
-	auto rawTex = GetTexture(name);
+auto Wad::LoadDecalTexture(const char* name) const -> std::optional<MipmapTexture> {
+	const auto rawTex = GetTexture(name);
 	if (rawTex.empty())
 		return {};
 
@@ -192,101 +232,125 @@ auto Wad::LoadDecalTexture(const char* name) -> std::optional<MipmapTexture> {
 }
 
 void Wad::LoadDirectory() {
-	auto header = read<WadHeader>(wadFile);
+	const auto header = wadFile.read<WadHeader>(0);
 
 	// check magic
 	if (header.magic[0] != 'W' || header.magic[1] != 'A' || header.magic[2] != 'D' || (header.magic[3] != '2' && header.magic[3] != '3'))
 		throw std::ios::failure("Unknown WAD magic number: " + std::string(header.magic, 4));
 
-	// read and sort directory
+	// read and index directory
+	if (header.nDir < 0 || header.dirOffset < 0)
+		throw std::ios::failure("Corrupt WAD directory");
+	const auto dir = wadFile.section(header.dirOffset, header.nDir * sizeof(WadDirEntry)).bytes();
 	dirEntries.resize(header.nDir);
-	wadFile.seekg(header.dirOffset);
-	readVector(wadFile, dirEntries);
+	std::memcpy(dirEntries.data(), dir.data(), dir.size());
 
-	std::sort(begin(dirEntries), end(dirEntries), [](const WadDirEntry& a, const WadDirEntry& b) {
-		return texNameLess(a.name, b.name);
-	});
+	// the keys view the names in the mapping, which is shared by copies of this Wad
+	m_directory.reserve(dirEntries.size());
+	for (auto i = 0u; i < dirEntries.size(); i++) {
+		const auto* name = reinterpret_cast<const char*>(dir.data() + i * sizeof(WadDirEntry) + offsetof(WadDirEntry, name));
+		m_directory.emplace(std::string_view{name, strnlen(name, bsp30::MAXTEXTURENAME)}, i);
+	}
 }
 
-auto Wad::GetTexture(const char* name) -> std::vector<uint8_t> {
-	const auto it = std::lower_bound(begin(dirEntries), end(dirEntries), name, [](const WadDirEntry& e, const char* name) {
-		return texNameLess(e.name, name);
-	});
-
-	if (it == end(dirEntries) || !texNameEqual(it->name, name))
+auto Wad::GetTexture(std::string_view name) const -> std::span<const uint8_t> {
+	const auto it = m_directory.find(name);
+	if (it == end(m_directory))
 		return {};
+	return GetTexture(it->second);
+}
+
+auto Wad::GetTexture(std::uint32_t entryIndex) const -> std::span<const uint8_t> {
+	const auto& entry = dirEntries[entryIndex];
 
 	// we can only handle uncompressed formats
-	if (it->compressed)
+	if (entry.compressed)
 		throw std::runtime_error("WAD texture cannot be loaded. Cannot read compressed items");
 
-	wadFile.seekg(it->nFilePos);
-	return readVector<uint8_t>(wadFile, it->nSize);
+	return wadFile.lumpView<uint8_t>(entry.nFilePos, entry.nSize);
 }
 
-void Wad::CreateMipTexture(const std::vector<uint8_t>& rawTexture, MipmapTexture& mipTex) {
+void Wad::CreateMipTexture(std::span<const uint8_t> rawTexture, MipmapTexture& mipTex) {
 	const auto* rawMipTex = (bsp30::MipTex*)rawTexture.data();
 
 	auto width = rawMipTex->width;
 	auto height = rawMipTex->height;
 	const auto palOffset = rawMipTex->offsets[3] + (width / 8) * (height / 8) + 2;
-	const auto* palette = rawTexture.data() + palOffset;
+	const auto lut = makeTextureLut(rawTexture.data() + palOffset);
+	const auto keyed = hasKeyColor(lut); // only textures with blue in their palette have transparent texels
 
 	for (int level = 0; level < bsp30::MIPLEVELS; level++) {
-		const auto* pixel = &(rawTexture[rawMipTex->offsets[level]]);
-
 		auto& img = mipTex.Img[level];
 		img.channels = 4;
 		img.width = width;
 		img.height = height;
 		img.data.resize(width * height * 4);
-
-		for (int i = 0; i < height * width; i++) {
-			int palIndex = pixel[i] * 3;
-
-			img.data[i * 4 + 0] = palette[palIndex + 0];
-			img.data[i * 4 + 1] = palette[palIndex + 1];
-			img.data[i * 4 + 2] = palette[palIndex + 2];
-			img.data[i * 4 + 3] = 255;
-		}
-
-		ApplyAlphaSections(mipTex.Img[level]);
+		expandPalette(rawTexture.subspan(rawMipTex->offsets[level], width * height), lut, img.data.data());
+		if (keyed)
+			ApplyAlphaSections(img);
 
 		width /= 2;
 		height /= 2;
 	}
 }
 
-void Wad::CreateDecalTexture(const std::vector<uint8_t>& rawTexture, MipmapTexture& mipTex) {
+void Wad::CreateDecalTexture(std::span<const uint8_t> rawTexture, MipmapTexture& mipTex) {
 	const auto* rawMipTex = (bsp30::MipTex*)rawTexture.data();
 
 	auto width = rawMipTex->width;
 	auto height = rawMipTex->height;
 	const auto palOffset = rawMipTex->offsets[3] + (width / 8) * (height / 8) + 2;
-	const auto* palette = rawTexture.data() + palOffset;
-	const auto* color = palette + 255 * 3;
+	const auto lut = makeDecalLut(rawTexture.data() + palOffset);
+	const auto keyed = hasKeyColor(lut);
 
 	for (int level = 0; level < bsp30::MIPLEVELS; level++) {
-		const auto* pixel = &(rawTexture[rawMipTex->offsets[level]]);
-
 		auto& img = mipTex.Img[level];
 		img.channels = 4;
 		img.width = width;
 		img.height = height;
 		img.data.resize(width * height * 4);
+		expandPalette(rawTexture.subspan(rawMipTex->offsets[level], width * height), lut, img.data.data());
+		if (keyed)
+			ApplyAlphaSections(img);
+
+		width /= 2;
+		height /= 2;
+	}
+}
 
-		for (int i = 0; i < height * width; i++) {
-			int palIndex = pixel[i] * 3;
+void Wad::CreatePalettizedTexture(std::span<const uint8_t> rawTexture, MipmapTexture& mipTex) {
+	const auto* rawMipTex = (bsp30::MipTex*)rawTexture.data();
 
-			img.data[i * 4 + 0] = color[0];
-			img.data[i * 4 + 1] = color[1];
-			img.data[i * 4 + 2] = color[2];
-			img.data[i * 4 + 3] = 255 - palette[palIndex];
-		}
+	auto width = rawMipTex->width;
+	auto height = rawMipTex->height;
+	const auto palOffset = rawMipTex->offsets[3] + (width / 8) * (height / 8) + 2;
+	auto& lut = mipTex.palette.emplace(makeTextureLut(rawTexture.data() + palOffset));
+	for (auto& t : lut)
+		if ((t & rgbBits) == keyColor)
+			t = keyColor;
 
-		ApplyAlphaSections(mipTex.Img[level]);
+	for (int level = 0; level < bsp30::MIPLEVELS; level++) {
+		auto& img = mipTex.Img[level];
+		img.channels = 1;
+		img.width = width;
+		img.height = height;
+		const auto indices = rawTexture.subspan(rawMipTex->offsets[level], width * height);
+		img.data.assign(indices.begin(), indices.end());
 
 		width /= 2;
 		height /= 2;
 	}
 }
+
+auto Wad::ExpandPalettized(const MipmapTexture& mipTex) -> std::vector<Image> {
+	// the key entries keep their blue color, so the dilation finds them
+	const auto& lut = *mipTex.palette;
+	std::vector<Image> levels;
+	for (const auto& indices : mipTex.Img) {
+		auto& img = levels.emplace_back(indices.width, indices.height, 4);
+		expandPalette(indices.data, lut, img.data.data());
+		if (hasKeyColor(lut))
+			ApplyAlphaSections(img);
+	}
+	return levels;
+}
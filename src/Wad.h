@@ -1,10 +1,15 @@
 #pragma once
 
 #include <cstdint>
-#include <fstream>
+#include <memory>
 #include <optional>
+#include <span>
+#include <string_view>
+#include <unordered_map>
 
+#include "IO.h"
 #include "Image.h"
+#include "Palette.h"
 #include "bspdef.h"
 
 struct WadHeader {
@@ -26,22 +31,44 @@ struct WadDirEntry {
 
 // Structure for holding data for mipmap textires
 struct MipmapTexture {
-	Image Img[bsp30::MIPLEVELS];
+	Image Img[bsp30::MIPLEVELS]; // decoded levels, empty if the texture views mapped levels
+	ImageView mapped[bsp30::MIPLEVELS]; // levels in memory kept alive by storage, e.g. a mapped runtime cache file
+	std::shared_ptr<const void> storage;
+	std::uint64_t contentHash = 0; // hash of the raw data the texture was decoded from, 0 if unknown
+	std::optional<PaletteLut> palette; // if set, Img holds one palette index per texel and the renderer resolves the colors. Blue key entries have zero alpha.
+
+	auto level(unsigned int i) const -> ImageView { return storage ? mapped[i] : ImageView{Img[i]}; }
+};
+
+// Texture names are compared case-insensitively
+struct TextureNameHash {
+	auto operator()(std::string_view name) const -> std::size_t;
+};
+struct TextureNameEqual {
+	auto operator()(std::string_view a, std::string_view b) const -> bool;
 };
 
 class Wad {
 public:
+	using Directory = std::unordered_map<std::string_view, std::uint32_t, TextureNameHash, TextureNameEqual>; // entry names, viewing the mapped directory, to entry indices
+
+
 	explicit Wad(const fs::path& path); // Opens a WAD File and loads it's directory for texture searching
 
-	auto loadTexture(const char* name) -> std::optional<MipmapTexture>;
-	auto LoadDecalTexture(const char* name) -> std::optional<MipmapTexture>;
-	static void CreateMipTexture(const std::vector<uint8_t>& rawTexture, MipmapTexture& pMipTex); // Creates a Miptexture out of the raw texture data
+	auto loadTexture(const char* name) const -> std::optional<MipmapTexture>;
+	auto LoadDecalTexture(const char* name) const -> std::optional<MipmapTexture>;
+	auto GetTexture(std::string_view name) const -> std::span<const uint8_t>; // Returns a view of the raw texture data in the mapped WAD, empty if the WAD does not contain the texture
+	auto GetTexture(std::uint32_t entry) const -> std::span<const uint8_t>;     // Returns a view of the raw texture data of a directory entry
+	auto directory() const -> const Directory& { return m_directory; }
+	static void CreateMipTexture(std::span<const uint8_t> rawTexture, MipmapTexture& pMipTex); // Creates a Miptexture out of the raw texture data
+	static void CreateDecalTexture(std::span<const uint8_t> rawTexture, MipmapTexture& pMipTex);
+	static void CreatePalettizedTexture(std::span<const uint8_t> rawTexture, MipmapTexture& pMipTex); // Keeps the texels as palette indices
+	static auto ExpandPalettized(const MipmapTexture& mipTex) -> std::vector<Image>; // RGBA mip levels of a palettized texture, equal to those of CreateMipTexture
 
 private:
-	std::ifstream wadFile;
+	MappedFile wadFile; // from a mounted archive or the file system
 	std::vector<WadDirEntry> dirEntries;
+	Directory m_directory;
 
 	void LoadDirectory(); // Loads the directory of the WAD file for further texture finding
-	auto GetTexture(const char* name) -> std::vector<uint8_t>;
-	void CreateDecalTexture(const std::vector<uint8_t>& rawTexture, MipmapTexture& pMipTex);
 };
@@ -8,6 +8,7 @@
 #include "Bsp.h"
 #include "BspRenderable.h"
 #include "HudRenderable.h"
+#include "MapRotation.h"
 #include "Image.h"
 #include "global.h"
 
@@ -25,18 +26,10 @@ namespace {
 	constexpr auto sensitivity = 5.0f;
 }
 
-Window::Window(render::IPlatform& platform, Bsp& bsp)
-	: GlfwWindow(WINDOW_CAPTION, platform), camera(pmove), hud(camera, timer), bsp(bsp), m_platform(platform) {
+Window::Window(render::IPlatform& platform, MapRotation& maps)
+	: GlfwWindow(WINDOW_CAPTION, platform), camera(pmove), hud(camera, timer), m_maps(maps), m_platform(platform) {
 
 	pmove.friction = 4;
-	for (auto* ladder : bsp.FindEntities("func_ladder")) {
-		if (auto* modelStr = ladder->findProperty("model")) {
-			const auto modelIndex = std::stoi(modelStr->substr(1));
-			const auto& model = bsp.models.at(modelIndex);
-			pmove.ladders.push_back(&model);
-		}
-	}
-	pmove.physents.push_back(&bsp.models.front()); // add at least the bsp model, TODO add other entities as well
 
 	IMGUI_CHECKVERSION();
 	ImGui::CreateContext();
@@ -44,22 +37,48 @@ Window::Window(render::IPlatform& platform, Bsp& bsp)
 
 	m_renderer = platform.createRenderer();
 
-	m_renderables.emplace_back(std::make_unique<BspRenderable>(*m_renderer, bsp, camera));
+	m_renderables.emplace_back(); // BspRenderable, created by loadMap
 	m_renderables.emplace_back(std::make_unique<HudRenderable>(*m_renderer, hud));
 
 	onResize(m_width, m_height);
 
+	loadMap();
+}
+
+void Window::loadMap() {
+	bsp = &m_maps.current();
+
+	const auto& table = bsp->entityTable;
+	pmove.ladders.clear();
+	for (auto* ladder : bsp->FindEntities("func_ladder"))
+		if (const auto modelIndex = table.model[ladder - &bsp->entities[0]]; modelIndex >= 0)
+			pmove.ladders.push_back(&bsp->models.at(modelIndex));
+	pmove.physents.clear();
+	pmove.physents.push_back(&bsp->models.front()); // add at least the bsp model, TODO add other entities as well
+	pmove.velocity = {};
+
+	// the previous BspRenderable is destroyed after the new one took over the textures both maps share
+	m_renderables.front() = std::make_unique<BspRenderable>(*m_renderer, *bsp, camera, m_textureCache, m_maps.takeGeometry());
+
 	// place camera at spawn
-	if (const auto info_player_start = bsp.FindEntity("info_player_start")) {
-		if (auto origin = info_player_start->findProperty("origin")) {
-			auto& o = camera.position();
-			std::istringstream(*origin) >> o.x >> o.y >> o.z;
-		}
+	if (const auto info_player_start = bsp->FindEntity("info_player_start")) {
+		const auto i = info_player_start - &bsp->entities[0];
+		if (table.hasOrigin[i])
+			camera.position() = table.origin[i];
+		if (info_player_start->findProperty("angle"))
+			camera.yaw() = table.angle[i];
+	}
+}
 
-		if (auto angle = info_player_start->findProperty("angle")) {
-			camera.yaw() = std::stof(*angle);
-		}
+void Window::switchMap() {
+	m_switchMap = false;
+	const auto previous = m_maps.advance();
+	if (!previous) {
+		hud.print("next map is not loaded yet");
+		return;
 	}
+	loadMap();
+	hud.print("switched map");
 }
 
 Window::~Window() {
@@ -119,6 +138,9 @@ void Window::mouseMove(UserCommand& cmd) {
 }
 
 void Window::update() {
+	if (m_switchMap)
+		switchMap();
+
 	timer.Tick();
 
 	std::stringstream windowText;
@@ -144,6 +166,7 @@ void Window::draw() {
 	m_settings.yaw = camera.yaw();
 
 	m_renderer->clear();
+	m_renderer->flushUploads();
 	for (auto& renderable : m_renderables)
 		renderable->render(m_settings);
 	if (global::renderCoords)
@@ -222,6 +245,10 @@ void Window::onKey(int key, int scancode, int action, int mods) {
 				break;
 			}
 
+			case GLFW_KEY_M:
+				m_switchMap = true;
+				break;
+
 			case GLFW_KEY_C:
 				global::renderCoords = !global::renderCoords;
 				if (global::renderCoords)
@@ -5,6 +5,7 @@
 #include "Hud.h"
 #include "Timer.h"
 #include "IRenderable.h"
+#include "BspRenderable.h"
 #include "move.h"
 
 namespace render {
@@ -12,10 +13,11 @@ namespace render {
 }
 
 class Bsp;
+class MapRotation;
 
 class Window : public GlfwWindow {
 public:
-	Window(render::IPlatform& platform, Bsp& bsp);
+	Window(render::IPlatform& platform, MapRotation& maps);
 	~Window();
 
 	void update();
@@ -32,16 +34,22 @@ private:
 	auto createMove() -> UserCommand;
 	void mouseMove(UserCommand& cmd);
 
+	void loadMap(); // sets up physics, rendering and the camera for the current map of the rotation
+	void switchMap();
+
 	Timer timer;
 	PlayerMove pmove{};
 	Camera camera;
 	Hud hud;
-	Bsp& bsp;
+	MapRotation& m_maps;
+	Bsp* bsp = nullptr;
+	bool m_switchMap = false; // switch at the next frame boundary
 
 	RenderSettings m_settings;
 	std::vector<std::unique_ptr<IRenderable>> m_renderables;
 	render::IPlatform& m_platform;
 	std::unique_ptr<render::IRenderer> m_renderer;
+	TextureCache m_textureCache;
 
 	bool m_captureMouse = false;
 	glm::dvec2 m_mouseDownPos;
@@ -13,6 +13,7 @@
 #include "../mathlib.h"
 #include "../global.h"
 #include "../Bsp.h"
+#include "../BlockCompression.h"
 
 #include "directx11/Shader.h"
 
@@ -27,7 +28,7 @@ namespace render::directx11 {
 	};
 
 	namespace {
-		auto channelsToTextureType(const Image& img) {
+		auto channelsToTextureType(const ImageView& img) {
 			switch (img.channels) {
 				case 1: return DXGI_FORMAT_R8_UNORM;
 				case 2: return DXGI_FORMAT_R8G8_UNORM;
@@ -196,15 +197,14 @@ namespace render::directx11 {
 		m_context->ClearDepthStencilView(m_fbDsv.Get(), D3D11_CLEAR_DEPTH, 1.0f, 0);
 	}
 
-	auto Renderer::createTexture(const std::vector<Image>& mipmaps) const -> std::unique_ptr<ITexture> {
+	auto Renderer::createTexture(const std::vector<ImageView>& mipmaps) const -> std::unique_ptr<ITexture> {
 		if (mipmaps.front().channels == 3) {
 			// create 4 channel images
 			std::vector<Image> mipmapsWithAlpha;
-			mipmapsWithAlpha.resize(mipmaps.size());
-			std::transform(begin(mipmaps), end(mipmaps), begin(mipmapsWithAlpha), [] (const Image& img){
-				return Image(img, 4);
-			});
-			return createTexture(mipmapsWithAlpha);
+			mipmapsWithAlpha.reserve(mipmaps.size());
+			for (const auto& img : mipmaps)
+				mipmapsWithAlpha.emplace_back(img, 4);
+			return createTexture(std::vector<ImageView>(begin(mipmapsWithAlpha), end(mipmapsWithAlpha)));
 		}
 
 		std::unique_ptr<Texture> t(new Texture());
@@ -225,8 +225,8 @@ namespace render::directx11 {
 		subresources.reserve(mipmaps.size());
 		for (const auto& mm : mipmaps) {
 			auto& sr = subresources.emplace_back();
-			sr.pSysMem = mm.data.data();
-			sr.SysMemPitch = mm.channels * mm.width;
+			sr.pSysMem = mm.data;
+			sr.SysMemPitch = static_cast<UINT>(mm.rowPitch);
 			sr.SysMemSlicePitch = 0;
 		}
 
@@ -237,21 +237,106 @@ namespace render::directx11 {
 		srvDesc.Format = desc.Format;
 		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
 		srvDesc.Texture2D.MostDetailedMip = 0;
-		srvDesc.Texture2D.MipLevels = 1;
+		srvDesc.Texture2D.MipLevels = desc.MipLevels; // all levels, so distant faces sample the small ones
 		if (FAILED(m_device->CreateShaderResourceView(t->t.Get(), &srvDesc, &t->srv)))
 			throw std::runtime_error("Failed to create 2D texture shader resource view");
 
 		return t;
 	}
 
-	auto Renderer::createCubeTexture(const std::array<Image, 6>& sides) const -> std::unique_ptr<ITexture> {
+	auto Renderer::createTextureAsync(std::vector<ImageView> mipmaps, std::shared_ptr<const void> owner) -> std::unique_ptr<ITexture> {
+		// the device creates resources free threaded and the driver uploads their initial data without blocking the immediate context
+		return createTexture(mipmaps);
+	}
+
+	auto Renderer::textureReady(const ITexture& texture) const -> bool {
+		return true;
+	}
+
+	void Renderer::flushUploads() {}
+
+	auto Renderer::createPalettizedTexture(const MipmapTexture& mipTex) const -> std::unique_ptr<ITexture> {
+		// no palette lookup in the shaders yet, expand on the CPU
+		const auto levels = Wad::ExpandPalettized(mipTex);
+		return createTexture(std::vector<ImageView>(begin(levels), end(levels)));
+	}
+
+	auto Renderer::supportsBlockCompression() const -> bool {
+		return true; // required by feature level 10 and above
+	}
+
+	auto Renderer::createCompressedTexture(const std::vector<CompressedImage>& mipmaps) const -> std::unique_ptr<ITexture> {
+		std::unique_ptr<Texture> t(new Texture());
+
+		D3D11_TEXTURE2D_DESC desc{};
+		desc.Width = mipmaps.front().width;
+		desc.Height = mipmaps.front().height;
+		desc.MipLevels = mipmaps.size();
+		desc.ArraySize = 1;
+		desc.Format = mipmaps.front().format == BlockFormat::BC1 ? DXGI_FORMAT_BC1_UNORM : DXGI_FORMAT_BC3_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_IMMUTABLE;
+		desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+		desc.CPUAccessFlags = 0;
+		desc.MiscFlags = 0;
+
+		std::vector<D3D11_SUBRESOURCE_DATA> subresources;
+		subresources.reserve(mipmaps.size());
+		for (const auto& mm : mipmaps) {
+			auto& sr = subresources.emplace_back();
+			sr.pSysMem = mm.blocks.data();
+			sr.SysMemPitch = (mm.width + 3) / 4 * blockBytes(mm.format); // one row of blocks
+			sr.SysMemSlicePitch = 0;
+		}
+
+		if (FAILED(m_device->CreateTexture2D(&desc, subresources.data(), &t->t)))
+			throw std::runtime_error("Failed to create compressed 2D texture");
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc{};
+		srvDesc.Format = desc.Format;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MostDetailedMip = 0;
+		srvDesc.Texture2D.MipLevels = desc.MipLevels;
+		if (FAILED(m_device->CreateShaderResourceView(t->t.Get(), &srvDesc, &t->srv)))
+			throw std::runtime_error("Failed to create 2D texture shader resource view");
+
+		return t;
+	}
+
+	auto Renderer::supportsTextureArrays() const -> bool {
+		return false; // main.hlsl samples single textures only
+	}
+
+	auto Renderer::createTextureArray(TextureArrayFormat format, unsigned int width, unsigned int height, unsigned int layers) const -> std::unique_ptr<ITexture> {
+		throw std::logic_error("Texture arrays are not supported by the Direct3D 11 renderer");
+	}
+
+	void Renderer::setTextureArrayLayer(ITexture& array, unsigned int layer, const std::vector<ImageView>& mipmaps, const PaletteLut* palette) const {
+		throw std::logic_error("Texture arrays are not supported by the Direct3D 11 renderer");
+	}
+
+	void Renderer::setTextureArrayLayer(ITexture& array, unsigned int layer, const std::vector<CompressedImage>& mipmaps) const {
+		throw std::logic_error("Texture arrays are not supported by the Direct3D 11 renderer");
+	}
+
+	void Renderer::setTextureArrayLayerAsync(ITexture& array, unsigned int layer, std::vector<ImageView> mipmaps, std::shared_ptr<const void> owner) {
+		throw std::logic_error("Texture arrays are not supported by the Direct3D 11 renderer");
+	}
+
+	void Renderer::setTextureArrayLayerAsync(ITexture& array, unsigned int layer, std::shared_ptr<const std::vector<CompressedImage>> mipmaps) {
+		throw std::logic_error("Texture arrays are not supported by the Direct3D 11 renderer");
+	}
+
+	auto Renderer::createCubeTexture(const std::array<ImageView, 6>& sides) const -> std::unique_ptr<ITexture> {
 		if (sides.front().channels == 3) {
 			// create 4 channel images
 			std::array<Image, 6> sidesAlpha;
-			std::transform(begin(sides), end(sides), begin(sidesAlpha), [](const Image& img) {
+			std::transform(begin(sides), end(sides), begin(sidesAlpha), [](const ImageView& img) {
 				return Image(img, 4);
 			});
-			return createCubeTexture(sidesAlpha);
+			std::array<ImageView, 6> views;
+			std::copy(begin(sidesAlpha), end(sidesAlpha), begin(views));
+			return createCubeTexture(views);
 		}
 
 		std::unique_ptr<Texture> t(new Texture());
@@ -273,8 +358,8 @@ namespace render::directx11 {
 		subresources.reserve(sides.size());
 		for (const auto& mm : sides) {
 			auto& sr = subresources.emplace_back();
-			sr.pSysMem = mm.data.data();
-			sr.SysMemPitch = mm.channels * mm.width;
+			sr.pSysMem = mm.data;
+			sr.SysMemPitch = static_cast<UINT>(mm.rowPitch);
 			sr.SysMemSlicePitch = 0;
 		}
 
@@ -360,7 +445,7 @@ namespace render::directx11 {
 		m_context->Draw(36, 0);
 	}
 
-	void Renderer::renderStatic(std::vector<EntityData> entities, const std::vector<Decal>& decals, IInputLayout& staticLayout, IInputLayout& decalLayout, std::vector<std::unique_ptr<render::ITexture>>& textures, render::ITexture& lightmapAtlas, const RenderSettings& settings) {
+	void Renderer::renderStatic(std::vector<EntityData> entities, std::vector<FaceRenderInfo> decals, IInputLayout& staticLayout, IInputLayout& decalLayout, render::ITexture& lightmapAtlas, const RenderSettings& settings) {
 		const UINT offset = 0;
 		m_context->IASetInputLayout(static_cast<InputLayout&>(staticLayout).l.Get());
 		m_context->IASetVertexBuffers(0, 1, static_cast<InputLayout&>(staticLayout).b->b.GetAddressOf(), &static_cast<InputLayout&>(staticLayout).stride, &offset);
@@ -388,7 +473,7 @@ namespace render::directx11 {
 		//	m_context->IASetInputLayout(static_cast<InputLayout&>(decalLayout).l.Get());
 		//	m_context->IASetVertexBuffers(0, 1, static_cast<InputLayout&>(decalLayout).b->b.GetAddressOf(), &static_cast<InputLayout&>(decalLayout).stride, &offset);
 
-		//	renderDecals(decals, textures);
+		//	renderDecals(std::move(decals));
 		//}
 	}
 
@@ -443,7 +528,7 @@ namespace render::directx11 {
 		}
 	}
 
-	void Renderer::renderDecals(const std::vector<Decal>& decals, std::vector<std::unique_ptr<render::ITexture>>& textures) {
+	void Renderer::renderDecals(std::vector<FaceRenderInfo> decals) {
 		//glEnable(GL_POLYGON_OFFSET_FILL);
 		//glPolygonOffset(0.0f, -2.0f);
 
@@ -469,11 +554,16 @@ namespace render::directx11 {
 
 		m_context->OMSetBlendState(blendState.Get(), nullptr, 0);
 
-		m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST); // TODO FAN
+		m_context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-		for (auto i = 0; i < decals.size(); i++) {
-			m_context->PSSetShaderResources(0, 1, static_cast<Texture&>(*textures[decals[i].texIndex]).srv.GetAddressOf());
-			m_context->Draw(4, i * 4);
+		// no multi draw in D3D11, but the decals share an atlas and arrive as merged ranges
+		ITexture* bound = nullptr;
+		for (const auto& d : decals) {
+			if (d.tex != bound) {
+				m_context->PSSetShaderResources(0, 1, static_cast<Texture&>(*d.tex).srv.GetAddressOf());
+				bound = d.tex;
+			}
+			m_context->Draw(d.count, d.offset);
 		}
 
 		m_context->OMSetBlendState(nullptr, nullptr, 0);
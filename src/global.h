@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstddef>
+
 enum class RenderAPI : int {
 	OpenGL,
 	Direct3D
@@ -23,6 +25,14 @@ namespace global {
 	inline bool nightvision = false;
 	inline bool flashlight = false;
 
+	inline bool palettizedTextures = false; // keep world textures as palette indices and resolve them on the GPU
+
+	inline bool compressTextures = false; // upload textures as BC1/BC3 if the renderer supports it
+
+	inline std::size_t textureBudget = 0; // bytes of world textures kept at full resolution on the GPU, 0 keeps all of them
+
+	inline std::size_t visCacheBytes = 1024 * 1024; // budget for decompressed PVS rows
+
 	inline int moveType = 0;
 	inline int hullIndex = 0;
 }
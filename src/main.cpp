@@ -1,14 +1,83 @@
+#include <chrono>
+#include <iomanip>
 #include <iostream>
+#include <span>
+#include <string_view>
+#include <vector>
 
 #ifdef _WIN32
 #include "directx11/Renderer.h"
 #endif
+#include "Archive.h"
 #include "Bsp.h"
+#include "BspCache.h"
+#include "BspRenderable.h"
+#include "MapRotation.h"
+#include "Palette.h"
+#include "Simd.h"
 #include "Window.h"
 #include "global.h"
 #include "opengl/Renderer.h"
 
-bool runWithPlatformAPI(const RenderAPI api, Bsp& bsp) {
+// Compares the palette expansion kernels with the original per byte loop on all miptextures of a WAD
+void benchPaletteExpansion(const fs::path& wadPath) {
+	const Wad wad(wadPath);
+
+	struct Level {
+		std::span<const std::uint8_t> indices;
+		const std::uint8_t* palette;
+		PaletteLut lut;
+	};
+	std::vector<Level> levels;
+	std::size_t texels = 0;
+	for (const auto& [name, entry] : wad.directory()) {
+		const auto raw = wad.GetTexture(entry);
+		if (raw.size() < sizeof(bsp30::MipTex))
+			continue;
+		const auto* mipTex = reinterpret_cast<const bsp30::MipTex*>(raw.data());
+		const auto palOffset = std::size_t{mipTex->offsets[3]} + (mipTex->width / 8) * (mipTex->height / 8) + 2;
+		if (mipTex->width == 0 || mipTex->height == 0 || palOffset + 768 > raw.size())
+			continue; // not a miptex
+		for (auto level = 0; level < bsp30::MIPLEVELS; level++) {
+			const auto count = std::size_t{mipTex->width >> level} * (mipTex->height >> level);
+			levels.push_back({raw.subspan(mipTex->offsets[level], count), raw.data() + palOffset, makeTextureLut(raw.data() + palOffset)});
+			texels += count;
+		}
+	}
+	std::clog << "Expanding " << levels.size() << " mip levels with " << texels << " texels\n";
+
+	std::vector<std::uint8_t> expected(texels * 4);
+	std::vector<std::uint8_t> out(texels * 4);
+	const auto run = [&](const char* name, bool verify, auto&& expand) {
+		constexpr auto repetitions = 20;
+		const auto start = std::chrono::steady_clock::now();
+		for (auto r = 0; r < repetitions; r++) {
+			auto* dst = out.data();
+			for (const auto& l : levels) {
+				expand(l, dst);
+				dst += l.indices.size() * 4;
+			}
+		}
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::clog << std::setw(10) << name << ": " << texels * repetitions / seconds / 1e6 << " Mtexel/s" << (verify && out != expected ? " MISMATCH" : "") << "\n";
+	};
+
+	run("reference", false, [](const Level& l, std::uint8_t* dst) {
+		for (std::size_t i = 0; i < l.indices.size(); i++) {
+			const int palIndex = l.indices[i] * 3;
+			dst[i * 4 + 0] = l.palette[palIndex + 0];
+			dst[i * 4 + 1] = l.palette[palIndex + 1];
+			dst[i * 4 + 2] = l.palette[palIndex + 2];
+			dst[i * 4 + 3] = 255;
+		}
+	});
+	expected = out;
+	for (const auto level : simdLevels)
+		if (simdLevelSupported(level))
+			run(simdLevelName(level), true, [&](const Level& l, std::uint8_t* dst) { expandPalette(l.indices, l.lut, dst, level); });
+}
+
+bool runWithPlatformAPI(const RenderAPI api, MapRotation& maps) {
 	auto platform = [&] {
 		switch (api) {
 			case RenderAPI::OpenGL: return std::unique_ptr<render::IPlatform>{new render::opengl::Platform};
@@ -17,7 +86,7 @@ bool runWithPlatformAPI(const RenderAPI api, Bsp& bsp) {
 		std::abort();
 	}();
 
-	Window window(*platform, bsp);
+	Window window(*platform, maps);
 
 	while (true) {
 		glfwPollEvents();
@@ -38,12 +107,98 @@ bool runWithPlatformAPI(const RenderAPI api, Bsp& bsp) {
 }
 
 auto main(const int argc, const char* argv[]) -> int try {
-	if (argc != 2)
+	std::vector<std::string_view> args(argv + 1, argv + argc);
+
+	// options
+	bool compress = false;
+	while (!args.empty()) {
+		if (args.size() >= 2 && args[0] == "--vis-cache-kb") {
+			global::visCacheBytes = std::stoul(std::string{args[1]}) * 1024;
+			args.erase(args.begin(), args.begin() + 2);
+		} else if (args.size() >= 2 && args[0] == "--texture-budget") {
+			global::textureBudget = std::stoul(std::string{args[1]}) * 1024 * 1024; // MiB
+			args.erase(args.begin(), args.begin() + 2);
+		} else if (args.size() >= 2 && args[0] == "--simd") {
+			const auto level = parseSimdLevel(args[1]);
+			if (!level)
+				throw std::runtime_error("Unknown SIMD level: " + std::string{args[1]} + ", expected scalar, sse4.2, avx2 or avx512");
+			setSimdLevel(*level);
+			args.erase(args.begin(), args.begin() + 2);
+		} else if (args.size() >= 2 && args[0] == "--mount") {
+			mountArchive(args[1]);
+			args.erase(args.begin(), args.begin() + 2);
+		} else if (args[0] == "--palettized") {
+			global::palettizedTextures = true;
+			args.erase(args.begin());
+		} else if (args[0] == "--compress-textures") {
+			global::compressTextures = true;
+			args.erase(args.begin());
+		} else if (args[0] == "--compress") {
+			compress = true;
+			args.erase(args.begin());
+		} else
+			break;
+	}
+
+	if (args.size() >= 3 && args[0] == "--headless") {
+		// load maps without a window, e.g. to measure startup of simulation hosts
+		const auto profile = [&] {
+			if (args[1] == "collision") return LoadProfile::Collision;
+			if (args[1] == "visibility") return LoadProfile::Visibility;
+			if (args[1] == "full") return LoadProfile::Full;
+			throw std::runtime_error("Unknown load profile " + std::string{args[1]} + ", expected collision, visibility or full");
+		}();
+		for (const auto& map : std::span{args}.subspan(2)) {
+			const auto start = std::chrono::steady_clock::now();
+			const Bsp bsp(map, {.profile = profile});
+			std::clog << "Loaded " << map << " in " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << "s\n";
+		}
+		return 0;
+	}
+
+	if (args.size() >= 3 && args[0] == "--pack") {
+		// offline step: pack maps with all WADs, sky images and runtime caches they use into one archive
+		std::vector<Archive::Source> sources;
+		const auto add = [&](const fs::path& path) {
+			const auto rel = path.lexically_normal().lexically_relative(DATA_DIR.lexically_normal());
+			if (rel.empty() || *rel.begin() == "..")
+				throw std::runtime_error(path.string() + " is not below " + DATA_DIR.string());
+			sources.push_back({rel.generic_string(), path});
+		};
+		for (const auto& map : std::span{args}.subspan(2)) {
+			const Bsp bsp(map, {.useCache = false});
+			for (const auto& path : bsp.sourceFiles)
+				add(path);
+			if (const auto sky = bsp.skyBoxFiles())
+				for (const auto& path : *sky)
+					add(path);
+			if (const auto cache = BspCache::pathFor(map); fileExists(cache))
+				add(cache);
+		}
+		Archive::pack(args[1], sources, compress);
+		return 0;
+	}
+
+	if (args.size() == 2 && args[0] == "--bench") {
+		benchPaletteExpansion(args[1]);
+		return 0;
+	}
+
+	if (args.size() == 2 && args[0] == "--compile-cache") {
+		// offline step: precompute everything derived from the map and its WADs
+		const fs::path bspPath = args[1];
+		const Bsp bsp(bspPath, {.useCache = false});
+		BspCache::write(BspCache::pathFor(bspPath), bsp, BspRenderable::buildStaticGeometry(bsp));
+		return 0;
+	}
+
+	if (args.empty())
 		throw std::runtime_error("Missing map name as command line argument");
 
-	Bsp bsp(argv[1]);
+	// further maps are preloaded in the background and shown one after another with M
+	MapRotation maps({args.begin(), args.end()});
 
-	while (runWithPlatformAPI(global::renderApi, bsp))
+	while (runWithPlatformAPI(global::renderApi, maps))
 		;
 
 	return 0;
@@ -4,9 +4,14 @@
 #include <imgui.h>
 #include <imgui_impl_opengl3.h>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <optional>
 
 #include "opengl/Texture.h"
+#include "../BlockCompression.h"
+#include "../Mipmap.h"
 #include "../IRenderable.h"
 #include "../Camera.h"
 #include "../Entity.h"
@@ -63,7 +68,7 @@ namespace render::opengl {
 			debugCallback(source, type, id, severity, length, message, static_cast<const void*>(userParam));
 		}
 
-		auto channelsToTextureType(const Image& img) {
+		auto channelsToTextureType(const ImageView& img) {
 			switch (img.channels) {
 				case 1: return GL_RED;
 				case 2: return GL_RG;
@@ -79,9 +84,54 @@ namespace render::opengl {
 				default: assert(false);
 			}
 		}
+
+		// rows of views may be padded, e.g. in a mapped file
+		void setUnpackRowLength(const ImageView& img) {
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, img.tight() ? 0 : static_cast<GLint>(img.rowPitch / img.channels));
+		}
+
+		constexpr std::size_t uploadBytesPerFrame = 4 * 1024 * 1024; // staged by flushUploads, a larger level is staged alone
 	}
 
-	struct Texture : ITexture, gl::Texture {};
+	struct PendingUpload {
+		GLuint texture;
+		std::optional<unsigned int> layer; // of a GL_TEXTURE_2D_ARRAY, otherwise the texture is a GL_TEXTURE_2D
+		std::vector<ImageView> levels;
+		std::shared_ptr<const std::vector<CompressedImage>> compressedLevels; // instead of levels for BC3 array layers
+		std::shared_ptr<const void> owner; // of the viewed pixels, released once all levels are submitted
+		std::size_t nextLevel = 0;
+		GLsync fence = nullptr;     // inserted after the last level was submitted
+
+		~PendingUpload() {
+			if (fence)
+				glDeleteSync(fence);
+		}
+
+		auto levelCount() const -> std::size_t {
+			return compressedLevels ? compressedLevels->size() : levels.size();
+		}
+
+		auto levelBytes(std::size_t level) const -> std::size_t {
+			if (compressedLevels)
+				return (*compressedLevels)[level].blocks.size();
+			const auto& img = levels[level];
+			return std::size_t{img.width} * img.height * img.channels;
+		}
+
+		auto completed() const -> bool {
+			if (!fence)
+				return false; // levels left to submit
+			const auto status = glClientWaitSync(fence, 0, 0);
+			return status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+		}
+	};
+
+	struct Texture : ITexture, gl::Texture {
+		std::optional<gl::Texture> palette; // 256 RGBA colors per layer if the texture holds palette indices
+		std::optional<TextureArrayFormat> arrayFormat; // set for GL_TEXTURE_2D_ARRAY textures
+		mutable std::shared_ptr<PendingUpload> upload; // until an asynchronous upload completed
+		mutable std::vector<std::shared_ptr<PendingUpload>> layerUploads; // asynchronous uploads of array layers until they completed
+	};
 
 	struct Buffer : IBuffer, gl::Buffer {};
 
@@ -162,19 +212,260 @@ namespace render::opengl {
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	}
 
-	auto Renderer::createTexture(const std::vector<Image>& mipmaps) const -> std::unique_ptr<ITexture> {
+	auto Renderer::createTexture(const std::vector<ImageView>& mipmaps) const -> std::unique_ptr<ITexture> {
+		std::unique_ptr<Texture> t(new Texture());
+		t->bind(GL_TEXTURE_2D);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(mipmaps.size() - 1));
+		for (std::size_t i = 0; i < mipmaps.size(); i++) {
+			setUnpackRowLength(mipmaps[i]);
+			glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), GL_RGBA, mipmaps[i].width, mipmaps[i].height, 0, channelsToTextureType(mipmaps[i]), GL_UNSIGNED_BYTE, mipmaps[i].data);
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		return t;
+	}
+
+	auto Renderer::createTextureAsync(std::vector<ImageView> mipmaps, std::shared_ptr<const void> owner) -> std::unique_ptr<ITexture> {
+		if (mipmaps.empty() || mipmaps.front().width == 0 || mipmaps.front().height == 0)
+			throw std::logic_error("Textures require a first level of at least 1x1");
+		std::unique_ptr<Texture> t(new Texture());
+		t->bind(GL_TEXTURE_2D);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(mipmaps.size() - 1));
+		if (GLEW_ARB_texture_storage)
+			glTexStorage2D(GL_TEXTURE_2D, static_cast<GLsizei>(mipmaps.size()), GL_RGBA8, mipmaps.front().width, mipmaps.front().height);
+		else
+			for (std::size_t i = 0; i < mipmaps.size(); i++)
+				glTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), GL_RGBA8, mipmaps[i].width, mipmaps[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		t->upload = std::make_shared<PendingUpload>();
+		t->upload->texture = t->id();
+		t->upload->levels = std::move(mipmaps);
+		t->upload->owner = std::move(owner);
+		m_uploadQueue.push_back(t->upload);
+		return t;
+	}
+
+	auto Renderer::textureReady(const ITexture& texture) const -> bool {
+		auto& t = static_cast<const Texture&>(texture);
+		std::erase_if(t.layerUploads, [](const auto& u) { return u->completed(); });
+		if (t.upload && t.upload->completed())
+			t.upload.reset();
+		return !t.upload && t.layerUploads.empty();
+	}
+
+	void Renderer::flushUploads() {
+		// take levels in queue order until the frame's staging budget is used
+		struct Level {
+			std::shared_ptr<PendingUpload> upload;
+			std::size_t level;
+			std::size_t offset; // in the staging buffer
+			bool last;
+		};
+		std::vector<Level> levels;
+		std::size_t size = 0;
+		while (!m_uploadQueue.empty()) {
+			auto upload = m_uploadQueue.front().lock();
+			if (!upload) {
+				m_uploadQueue.pop_front(); // texture destroyed meanwhile
+				continue;
+			}
+			const auto bytes = upload->levelBytes(upload->nextLevel);
+			if (size > 0 && size + bytes > uploadBytesPerFrame)
+				break;
+			const auto last = upload->nextLevel + 1 == upload->levelCount();
+			levels.push_back({upload, upload->nextLevel++, size, last});
+			size += (bytes + 3) & ~std::size_t{3};
+			if (last)
+				m_uploadQueue.pop_front();
+		}
+		if (levels.empty())
+			return;
+
+		// copy tightly packed into fresh staging memory, the driver transfers it to the textures without stalling this thread
+		m_uploadBuffer.bind(GL_PIXEL_UNPACK_BUFFER);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+		auto* staging = static_cast<std::uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+		if (!staging)
+			throw std::runtime_error("Failed to map texture staging buffer");
+		for (const auto& l : levels) {
+			if (l.upload->compressedLevels) {
+				const auto& blocks = (*l.upload->compressedLevels)[l.level].blocks;
+				std::memcpy(staging + l.offset, blocks.data(), blocks.size());
+				continue;
+			}
+			const auto& img = l.upload->levels[l.level];
+			for (auto y = 0u; y < img.height; y++) {
+				const auto row = img.row(y);
+				std::memcpy(staging + l.offset + y * row.size(), row.data(), row.size());
+			}
+		}
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (const auto& l : levels) {
+			const auto& u = *l.upload;
+			const auto level = static_cast<GLint>(l.level);
+			const auto* offset = reinterpret_cast<const void*>(l.offset);
+			if (!u.layer) {
+				const auto& img = u.levels[l.level];
+				glBindTexture(GL_TEXTURE_2D, u.texture);
+				glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, img.width, img.height, channelsToTextureType(img), GL_UNSIGNED_BYTE, offset);
+			} else if (u.compressedLevels) {
+				const auto& mm = (*u.compressedLevels)[l.level];
+				glBindTexture(GL_TEXTURE_2D_ARRAY, u.texture);
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, *u.layer, mm.width, mm.height, 1, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, static_cast<GLsizei>(mm.blocks.size()), offset);
+			} else {
+				const auto& img = u.levels[l.level];
+				glBindTexture(GL_TEXTURE_2D_ARRAY, u.texture);
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, *u.layer, img.width, img.height, 1, channelsToTextureType(img), GL_UNSIGNED_BYTE, offset);
+			}
+			if (l.last) {
+				l.upload->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				l.upload->levels = {};
+				l.upload->compressedLevels = nullptr;
+				l.upload->owner = nullptr;
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	auto Renderer::createPalettizedTexture(const MipmapTexture& mipTex) const -> std::unique_ptr<ITexture> {
 		std::unique_ptr<Texture> t(new Texture());
 		t->bind(GL_TEXTURE_2D);
 		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		// indices must not be interpolated, main.frag filters the resolved colors
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, bsp30::MIPLEVELS - 1);
+		for (int i = 0; i < bsp30::MIPLEVELS; i++)
+			glTexImage2D(GL_TEXTURE_2D, i, GL_R8, mipTex.Img[i].width, mipTex.Img[i].height, 0, GL_RED, GL_UNSIGNED_BYTE, mipTex.Img[i].data.data());
+
+		t->palette.emplace();
+		t->palette->bind(GL_TEXTURE_2D);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, mipTex.palette->data());
+		return t;
+	}
+
+	auto Renderer::supportsBlockCompression() const -> bool {
+		return GLEW_EXT_texture_compression_s3tc;
+	}
+
+	auto Renderer::createCompressedTexture(const std::vector<CompressedImage>& mipmaps) const -> std::unique_ptr<ITexture> {
+		std::unique_ptr<Texture> t(new Texture());
+		t->bind(GL_TEXTURE_2D);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(mipmaps.size() - 1));
-		for (int i = 0; i < mipmaps.size(); i++)
-			glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA, mipmaps[i].width, mipmaps[i].height, 0, channelsToTextureType(mipmaps[i]), GL_UNSIGNED_BYTE, mipmaps[i].data.data());
+		for (std::size_t i = 0; i < mipmaps.size(); i++) {
+			const auto& mm = mipmaps[i];
+			const auto format = mm.format == BlockFormat::BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+			glCompressedTexImage2D(GL_TEXTURE_2D, static_cast<GLint>(i), format, mm.width, mm.height, 0, static_cast<GLsizei>(mm.blocks.size()), mm.blocks.data());
+		}
 		return t;
 	}
 
-	auto Renderer::createCubeTexture(const std::array<Image, 6>& sides) const -> std::unique_ptr<ITexture> {
+	auto Renderer::supportsTextureArrays() const -> bool {
+		return true;
+	}
+
+	auto Renderer::createTextureArray(TextureArrayFormat format, unsigned int width, unsigned int height, unsigned int layers) const -> std::unique_ptr<ITexture> {
+		std::unique_ptr<Texture> t(new Texture());
+		t->arrayFormat = format;
+		t->bind(GL_TEXTURE_2D_ARRAY);
+		const auto indexed = format == TextureArrayFormat::Indexed; // filtered in main.frag
+		const auto levels = indexed ? bsp30::MIPLEVELS : static_cast<int>(mipLevelCount(width, height));
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, indexed ? GL_NEAREST : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, indexed ? GL_NEAREST_MIPMAP_NEAREST : GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		for (int i = 0; i < levels; i++) {
+			const auto w = std::max(width >> i, 1u);
+			const auto h = std::max(height >> i, 1u);
+			switch (format) {
+				case TextureArrayFormat::RGBA8:
+					glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_RGBA8, w, h, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+					break;
+				case TextureArrayFormat::Indexed:
+					glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_R8, w, h, layers, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+					break;
+				case TextureArrayFormat::BC3:
+					glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, w, h, layers, 0, (w + 3) / 4 * ((h + 3) / 4) * 16 * layers, nullptr);
+					break;
+			}
+		}
+
+		if (indexed) {
+			t->palette.emplace();
+			t->palette->bind(GL_TEXTURE_2D);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+		return t;
+	}
+
+	void Renderer::setTextureArrayLayer(ITexture& array, unsigned int layer, const std::vector<ImageView>& mipmaps, const PaletteLut* palette) const {
+		auto& t = static_cast<Texture&>(array);
+		t.bind(GL_TEXTURE_2D_ARRAY);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (std::size_t i = 0; i < mipmaps.size(); i++) {
+			setUnpackRowLength(mipmaps[i]);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(i), 0, 0, layer, mipmaps[i].width, mipmaps[i].height, 1, channelsToTextureType(mipmaps[i]), GL_UNSIGNED_BYTE, mipmaps[i].data);
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+		if (t.palette) {
+			if (!palette)
+				throw std::logic_error("Indexed texture arrays require a palette per layer");
+			t.palette->bind(GL_TEXTURE_2D);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, layer, 256, 1, GL_RGBA, GL_UNSIGNED_BYTE, palette->data());
+		}
+	}
+
+	void Renderer::setTextureArrayLayer(ITexture& array, unsigned int layer, const std::vector<CompressedImage>& mipmaps) const {
+		static_cast<Texture&>(array).bind(GL_TEXTURE_2D_ARRAY);
+		for (std::size_t i = 0; i < mipmaps.size(); i++) {
+			const auto& mm = mipmaps[i];
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(i), 0, 0, layer, mm.width, mm.height, 1, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, static_cast<GLsizei>(mm.blocks.size()), mm.blocks.data());
+		}
+	}
+
+	void Renderer::setTextureArrayLayerAsync(ITexture& array, unsigned int layer, std::vector<ImageView> mipmaps, std::shared_ptr<const void> owner) {
+		auto& t = static_cast<Texture&>(array);
+		if (t.palette)
+			throw std::logic_error("Indexed texture array layers are uploaded synchronously");
+		auto upload = std::make_shared<PendingUpload>();
+		upload->layer = layer;
+		upload->levels = std::move(mipmaps);
+		queueLayerUpload(t, std::move(upload), std::move(owner));
+	}
+
+	void Renderer::setTextureArrayLayerAsync(ITexture& array, unsigned int layer, std::shared_ptr<const std::vector<CompressedImage>> mipmaps) {
+		auto upload = std::make_shared<PendingUpload>();
+		upload->layer = layer;
+		upload->compressedLevels = std::move(mipmaps);
+		queueLayerUpload(static_cast<Texture&>(array), std::move(upload), nullptr);
+	}
+
+	void Renderer::queueLayerUpload(Texture& array, std::shared_ptr<PendingUpload> upload, std::shared_ptr<const void> owner) {
+		std::erase_if(array.layerUploads, [](const auto& u) { return u->completed(); });
+		upload->texture = array.id();
+		upload->owner = std::move(owner);
+		m_uploadQueue.push_back(upload);
+		array.layerUploads.push_back(std::move(upload));
+	}
+
+	auto Renderer::createCubeTexture(const std::array<ImageView, 6>& sides) const -> std::unique_ptr<ITexture> {
 		std::unique_ptr<Texture> t(new Texture());
 		t->bind(GL_TEXTURE_CUBE_MAP);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -182,8 +473,12 @@ namespace render::opengl {
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		for (auto i = 0; i < 6; i++)
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, sides[i].width, sides[i].height, 0, sides[i].channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, sides[i].data.data());
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (auto i = 0; i < 6; i++) {
+			setUnpackRowLength(sides[i]);
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, sides[i].width, sides[i].height, 0, sides[i].channels == 3 ? GL_RGB : GL_RGBA, GL_UNSIGNED_BYTE, sides[i].data);
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 		return t;
 	}
 
@@ -231,11 +526,13 @@ namespace render::opengl {
 		glDepthMask(GL_TRUE);
 	}
 
-	void Renderer::renderStatic(std::vector<EntityData> entities, const std::vector<Decal>& decals, IInputLayout& staticLayout, IInputLayout& decalLayout, std::vector<std::unique_ptr<render::ITexture>>& textures, render::ITexture& lightmapAtlas, const RenderSettings& settings) {
+	void Renderer::renderStatic(std::vector<EntityData> entities, std::vector<FaceRenderInfo> decals, IInputLayout& staticLayout, IInputLayout& decalLayout, render::ITexture& lightmapAtlas, const RenderSettings& settings) {
 		static_cast<InputLayout&>(staticLayout).bind();
 		m_shaderProgram.use();
 		glUniform1i(m_shaderProgram.uniformLocation("tex1"), 0);
 		glUniform1i(m_shaderProgram.uniformLocation("tex2"), 1);
+		glUniform1i(m_shaderProgram.uniformLocation("palette"), 2);
+		glUniform1i(m_shaderProgram.uniformLocation("tex1Array"), 3);
 		glUniform1i(m_shaderProgram.uniformLocation("nightvision"), static_cast<GLint>(global::nightvision));
 		//glUniform1i(m_shaderProgram.uniformLocation("flashlight"), static_cast<GLint>(settings.flashlight));
 		glUniform1i(m_shaderProgram.uniformLocation("unit1Enabled"), static_cast<GLint>(global::textures));
@@ -249,13 +546,14 @@ namespace render::opengl {
 			renderBrushEntity(std::move(ent.fri), lightmapAtlas, settings, ent.origin, ent.alpha, ent.renderMode);
 
 		glUniform1i(m_shaderProgram.uniformLocation("unit2Enabled"), 0);
+		glUniform1i(m_shaderProgram.uniformLocation("palettized"), 0); // decals are RGBA
 
 		const auto matrix = settings.projection * settings.view;
 		glUniformMatrix4fv(m_shaderProgram.uniformLocation("matrix"), 1, false, glm::value_ptr(matrix));
 
 		if (global::renderDecals) {
 			static_cast<InputLayout&>(decalLayout).bind();
-			renderDecals(decals, textures);
+			renderDecals(std::move(decals));
 		}
 
 		glDisable(GL_DEPTH_TEST);
@@ -302,25 +600,60 @@ namespace render::opengl {
 	}
 
 	void Renderer::renderFri(std::vector<FaceRenderInfo> fri, render::ITexture& lightmapAtlas) {
-		// sort by texture id to avoid some rebinds
-		//std::sort(begin(fri), end(fri), [](const FaceRenderInfo& a, const FaceRenderInfo& b) {
-		//	return a.tex < b.tex;
-		//});
+		// sort by texture to avoid rebinds, faces of all layers of a texture array are drawn at once
+		std::sort(begin(fri), end(fri), [](const FaceRenderInfo& a, const FaceRenderInfo& b) {
+			return a.tex < b.tex;
+		});
 
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, static_cast<Texture&>(lightmapAtlas).id());
 		glActiveTexture(GL_TEXTURE0);
-		ITexture* curId = nullptr;
-		for (const auto& i : fri) {
-			if (curId != i.tex) {
-				glBindTexture(GL_TEXTURE_2D, static_cast<Texture&>(*i.tex).id());
-				curId = i.tex;
+		glUniform1i(m_shaderProgram.uniformLocation("palettized"), 0);
+		glUniform1i(m_shaderProgram.uniformLocation("arrayTexture"), 0);
+		bool palettized = false;
+		bool arrayTexture = false;
+
+		std::vector<GLint> firsts;
+		std::vector<GLsizei> counts;
+		for (auto run = begin(fri); run != end(fri);) {
+			const auto runEnd = std::find_if(run, end(fri), [&](const FaceRenderInfo& i) { return i.tex != run->tex; });
+
+			if (run->tex) {
+				const auto& tex = static_cast<Texture&>(*run->tex);
+				if (tex.arrayFormat) {
+					glActiveTexture(GL_TEXTURE3);
+					glBindTexture(GL_TEXTURE_2D_ARRAY, tex.id());
+				} else
+					glBindTexture(GL_TEXTURE_2D, tex.id());
+				if (tex.palette) {
+					glActiveTexture(GL_TEXTURE2);
+					glBindTexture(GL_TEXTURE_2D, tex.palette->id());
+				}
+				glActiveTexture(GL_TEXTURE0);
+
+				if (palettized != tex.palette.has_value()) {
+					palettized = tex.palette.has_value();
+					glUniform1i(m_shaderProgram.uniformLocation("palettized"), palettized);
+				}
+				if (arrayTexture != tex.arrayFormat.has_value()) {
+					arrayTexture = tex.arrayFormat.has_value();
+					glUniform1i(m_shaderProgram.uniformLocation("arrayTexture"), arrayTexture);
+				}
 			}
-			glDrawArrays(GL_TRIANGLES, i.offset, i.count);
+
+			firsts.clear();
+			counts.clear();
+			for (auto i = run; i != runEnd; ++i) {
+				firsts.push_back(static_cast<GLint>(i->offset));
+				counts.push_back(static_cast<GLsizei>(i->count));
+			}
+			glMultiDrawArrays(GL_TRIANGLES, firsts.data(), counts.data(), static_cast<GLsizei>(firsts.size()));
+			run = runEnd;
 		}
+		glUniform1i(m_shaderProgram.uniformLocation("arrayTexture"), 0);
 	}
 
-	void Renderer::renderDecals(const std::vector<Decal>& decals, std::vector<std::unique_ptr<render::ITexture>>& textures) {
+	void Renderer::renderDecals(std::vector<FaceRenderInfo> decals) {
 		glEnable(GL_POLYGON_OFFSET_FILL);
 		glPolygonOffset(0.0f, -2.0f);
 		glEnable(GL_BLEND);
@@ -328,9 +661,23 @@ namespace render::opengl {
 
 		glActiveTexture(GL_TEXTURE0);
 
-		for (auto i = 0; i < decals.size(); i++) {
-			glBindTexture(GL_TEXTURE_2D, static_cast<Texture&>(*textures[decals[i].texIndex]).id());
-			glDrawArrays(GL_TRIANGLES, i * 4, 4);
+		// decals share an atlas, so this is usually a single draw
+		std::sort(begin(decals), end(decals), [](const FaceRenderInfo& a, const FaceRenderInfo& b) {
+			return a.tex < b.tex;
+		});
+		std::vector<GLint> firsts;
+		std::vector<GLsizei> counts;
+		for (auto run = begin(decals); run != end(decals);) {
+			const auto runEnd = std::find_if(run, end(decals), [&](const FaceRenderInfo& i) { return i.tex != run->tex; });
+			glBindTexture(GL_TEXTURE_2D, static_cast<Texture&>(*run->tex).id());
+			firsts.clear();
+			counts.clear();
+			for (auto i = run; i != runEnd; ++i) {
+				firsts.push_back(static_cast<GLint>(i->offset));
+				counts.push_back(static_cast<GLsizei>(i->count));
+			}
+			glMultiDrawArrays(GL_TRIANGLES, firsts.data(), counts.data(), static_cast<GLsizei>(firsts.size()));
+			run = runEnd;
 		}
 
 		glDisable(GL_BLEND);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <deque>
+#include <memory>
 #include <vector>
 
 #include "../IRenderer.h"
@@ -8,6 +10,9 @@
 #include "opengl/Buffer.h"
 
 namespace render::opengl {
+	struct PendingUpload;
+	struct Texture;
+
 	class Renderer : public IRenderer {
 	public:
 		Renderer();
@@ -16,14 +21,26 @@ namespace render::opengl {
 		virtual void resizeViewport(int width, int height) override;
 		virtual void clear() override;
 
-		virtual auto createTexture(const std::vector<Image>& mipmaps) const -> std::unique_ptr<ITexture> override;
-		virtual auto createCubeTexture(const std::array<Image, 6>& sides) const -> std::unique_ptr<ITexture> override;
+		virtual auto createTexture(const std::vector<ImageView>& mipmaps) const -> std::unique_ptr<ITexture> override;
+		virtual auto createTextureAsync(std::vector<ImageView> mipmaps, std::shared_ptr<const void> owner) -> std::unique_ptr<ITexture> override;
+		virtual auto textureReady(const ITexture& texture) const -> bool override;
+		virtual void flushUploads() override;
+		virtual auto createPalettizedTexture(const MipmapTexture& mipTex) const -> std::unique_ptr<ITexture> override;
+		virtual auto supportsBlockCompression() const -> bool override;
+		virtual auto createCompressedTexture(const std::vector<CompressedImage>& mipmaps) const -> std::unique_ptr<ITexture> override;
+		virtual auto supportsTextureArrays() const -> bool override;
+		virtual auto createTextureArray(TextureArrayFormat format, unsigned int width, unsigned int height, unsigned int layers) const -> std::unique_ptr<ITexture> override;
+		virtual void setTextureArrayLayer(ITexture& array, unsigned int layer, const std::vector<ImageView>& mipmaps, const PaletteLut* palette) const override;
+		virtual void setTextureArrayLayer(ITexture& array, unsigned int layer, const std::vector<CompressedImage>& mipmaps) const override;
+		virtual void setTextureArrayLayerAsync(ITexture& array, unsigned int layer, std::vector<ImageView> mipmaps, std::shared_ptr<const void> owner) override;
+		virtual void setTextureArrayLayerAsync(ITexture& array, unsigned int layer, std::shared_ptr<const std::vector<CompressedImage>> mipmaps) override;
+		virtual auto createCubeTexture(const std::array<ImageView, 6>& sides) const -> std::unique_ptr<ITexture> override;
 		virtual auto createBuffer(std::size_t size, const void* data) const -> std::unique_ptr<IBuffer> override;
 		virtual auto createInputLayout(IBuffer& buffer, const std::vector<AttributeLayout>& layout) const -> std::unique_ptr<IInputLayout> override;
 
 		virtual void renderCoords(const glm::mat4& matrix) override;
 		virtual void renderSkyBox(ITexture& cubemap, const glm::mat4& matrix) override;
-		virtual void renderStatic(std::vector<EntityData> entities, const std::vector<Decal>& decals, IInputLayout& staticLayout, IInputLayout& decalLayout, std::vector<std::unique_ptr<render::ITexture>>& textures, render::ITexture& lightmapAtlas, const RenderSettings& settings) override;
+		virtual void renderStatic(std::vector<EntityData> entities, std::vector<FaceRenderInfo> decals, IInputLayout& staticLayout, IInputLayout& decalLayout, render::ITexture& lightmapAtlas, const RenderSettings& settings) override;
 		virtual void renderImgui(ImDrawData* data) override;
 
 		virtual auto screenshot() const -> Image override;
@@ -31,12 +48,16 @@ namespace render::opengl {
 	private:
 		void renderBrushEntity(std::vector<FaceRenderInfo> fri, render::ITexture& lightmapAtlas, const RenderSettings& settings, glm::vec3 origin, float alpha, bsp30::RenderMode renderMode);
 		void renderFri(std::vector<FaceRenderInfo> fri, render::ITexture& lightmapAtlas);
-		void renderDecals(const std::vector<Decal>& decals, std::vector<std::unique_ptr<render::ITexture>>& textures);
+		void renderDecals(std::vector<FaceRenderInfo> decals);
+		void queueLayerUpload(Texture& array, std::shared_ptr<PendingUpload> upload, std::shared_ptr<const void> owner);
 
 		struct Glew {
 			Glew();
 		} m_glew;
 
+		std::deque<std::weak_ptr<PendingUpload>> m_uploadQueue; // uploads with levels left to submit, expired if the texture was destroyed
+		gl::Buffer m_uploadBuffer; // staging memory, a pixel unpack buffer orphaned every frame
+
 		gl::VAO m_emptyVao;
 		gl::Program m_skyboxProgram;
 		gl::Program m_shaderProgram;
@@ -5,20 +5,67 @@ uniform bool unit2Enabled;
 
 uniform bool nightvision;
 uniform bool alphaTest;
+uniform bool palettized; // tex1 holds palette indices, resolved through palette
+uniform bool arrayTexture; // tex1Array is sampled instead of tex1, at layer texLayer
 
 uniform sampler2D tex1;
 uniform sampler2D tex2;
+uniform sampler2D palette; // one row per layer
+uniform sampler2DArray tex1Array;
 
 in vec2 texCoord;
 in vec2 lightmapCoord;
+flat in float texLayer;
 
 out vec4 color;
 
+const int paletteMaxLevel = 3; // miptextures have 4 levels
+
+ivec2 tex1Size(int level) {
+	return arrayTexture ? textureSize(tex1Array, level).xy : textureSize(tex1, level);
+}
+
+float tex1Fetch(ivec2 pos, int level) {
+	return arrayTexture ? texelFetch(tex1Array, ivec3(pos, int(texLayer)), level).r : texelFetch(tex1, pos, level).r;
+}
+
+vec4 paletteTexel(ivec2 pos, int level, ivec2 size) {
+	pos -= size * ivec2(floor(vec2(pos) / vec2(size))); // repeat, pos may be negative
+	int index = int(tex1Fetch(pos, level) * 255.0 + 0.5);
+	vec4 c = texelFetch(palette, ivec2(index, arrayTexture ? int(texLayer) : 0), 0);
+	return vec4(c.rgb * c.a, c.a);
+}
+
+// bilinear filtering of the resolved colors of the nearest mip level. The colors are premultiplied, so transparent texels do not bleed their key color.
+vec4 samplePalettized(vec2 uv) {
+	vec2 uv0 = uv * vec2(tex1Size(0));
+	vec2 dx = dFdx(uv0);
+	vec2 dy = dFdy(uv0);
+	float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+	int level = int(clamp(floor(lod + 0.5), 0.0, float(paletteMaxLevel)));
+
+	ivec2 size = tex1Size(level);
+	vec2 p = uv * vec2(size) - 0.5;
+	ivec2 i = ivec2(floor(p));
+	vec2 f = fract(p);
+	vec4 c = mix(
+		mix(paletteTexel(i, level, size), paletteTexel(i + ivec2(1, 0), level, size), f.x),
+		mix(paletteTexel(i + ivec2(0, 1), level, size), paletteTexel(i + ivec2(1, 1), level, size), f.x),
+		f.y);
+	return c.a > 0.0 ? vec4(c.rgb / c.a, c.a) : vec4(0.0);
+}
+
+vec4 sampleTex1(vec2 uv) {
+	if (palettized)
+		return samplePalettized(uv);
+	return arrayTexture ? texture(tex1Array, vec3(uv, texLayer)) : texture2D(tex1, uv);
+}
+
 void Nightvision() {
 	vec4 c1 = color / 2.0;
-	c1 += texture2D(tex1, texCoord.st + 0.01);
-	c1 += texture2D(tex1, texCoord.st + 0.02);
-	c1 += texture2D(tex1, texCoord.st + 0.03);
+	c1 += sampleTex1(texCoord.st + 0.01);
+	c1 += sampleTex1(texCoord.st + 0.02);
+	c1 += sampleTex1(texCoord.st + 0.03);
 
 	vec4 c2 = color / 2.0;
 	c2 += texture2D(tex2, lightmapCoord.st + 0.01);
@@ -37,7 +84,7 @@ void main() {
 	vec4 texel2 = vec4(1.0);
 
 	if (unit1Enabled) {
-		texel1 = texture2D(tex1, texCoord);
+		texel1 = sampleTex1(texCoord);
 		if (alphaTest && texel1.a < 0.25)
 			discard;
 	}
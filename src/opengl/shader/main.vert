@@ -9,12 +9,15 @@ layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec2 inTexCoord;
 layout(location = 3) in vec2 inLightmapCoord;
+layout(location = 4) in float inTexLayer;
 
 out vec2 texCoord;
 out vec2 lightmapCoord;
+flat out float texLayer;
 
 void main() {
 	gl_Position = matrix * vec4(inPosition, 1.0);
 	texCoord = inTexCoord;
 	lightmapCoord = inLightmapCoord;
+	texLayer = inTexLayer;
 }